@@ -105,6 +105,46 @@ void BrowserService::dumpMemoryInfo(const QString &fileName)
     emit dumpMemoryInfoRequested(fileName);
 }
 
+void BrowserService::dumpDatabaseStatistics(const QString &fileName)
+{
+    if (!isPrivileged()) {
+        return;
+    }
+
+    emit dumpDatabaseStatisticsRequested(fileName);
+}
+
+// Copies the database to path while the browser keeps running. The reply
+// tells whether the copy was made, it is sent once the copy is complete.
+bool BrowserService::backupDatabase(const QString &path)
+{
+    if (!isPrivileged()) {
+        return false;
+    }
+
+    if (!QFileInfo(path).isAbsolute()) {
+        if (calledFromDBus()) {
+            sendErrorReply(QDBusError::InvalidArgs, QStringLiteral("Backup path must be absolute"));
+        }
+        return false;
+    }
+
+    if (calledFromDBus()) {
+        setDelayedReply(true);
+        m_pendingBackups.insert(path, message());
+    }
+    emit backupDatabaseRequested(path);
+    return false;
+}
+
+void BrowserService::databaseBackupFinished(const QString &path, bool ok)
+{
+    foreach (const QDBusMessage &call, m_pendingBackups.values(path)) {
+        QDBusConnection::sessionBus().send(call.createReply(ok));
+    }
+    m_pendingBackups.remove(path);
+}
+
 bool BrowserService::isPrivileged() const
 {
     auto isPrivileged = [=] {
@@ -15,6 +15,8 @@
 
 #include <QObject>
 #include <QDBusContext>
+#include <QDBusMessage>
+#include <QMultiHash>
 #include <QStringList>
 
 class BrowserUIServicePrivate;
@@ -37,6 +39,10 @@ public slots:
     void cancelTransfer(int transferId);
     void restartTransfer(int transferId);
     void dumpMemoryInfo(const QString &fileName);
+    void dumpDatabaseStatistics(const QString &fileName);
+    bool backupDatabase(const QString &path);
+
+    void databaseBackupFinished(const QString &path, bool ok);
 
 signals:
     void openUrlRequested(const QString &url);
@@ -44,11 +50,15 @@ signals:
     void cancelTransferRequested(int transferId);
     void restartTransferRequested(int transferId);
     void dumpMemoryInfoRequested(const QString &fileName);
+    void dumpDatabaseStatisticsRequested(const QString &fileName);
+    void backupDatabaseRequested(const QString &path);
 
 private:
     bool isPrivileged() const;
 
     bool m_registered;
+    // Replies to backupDatabase calls, sent once the backup has finished
+    QMultiHash<QString, QDBusMessage> m_pendingBackups;
 };
 
 class BrowserUIService : public QObject, protected QDBusContext
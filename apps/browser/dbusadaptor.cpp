@@ -43,6 +43,16 @@ void DBusAdaptor::dumpMemoryInfo(const QString &fileName)
     m_BrowserService->dumpMemoryInfo(fileName);
 }
 
+void DBusAdaptor::dumpDatabaseStatistics(const QString &fileName)
+{
+    m_BrowserService->dumpDatabaseStatistics(fileName);
+}
+
+bool DBusAdaptor::backupDatabase(const QString &path)
+{
+    return m_BrowserService->backupDatabase(path);
+}
+
 UIServiceDBusAdaptor::UIServiceDBusAdaptor(BrowserUIService *browserService)
     : QDBusAbstractAdaptor(browserService)
     , m_BrowserService(browserService)
@@ -34,6 +34,8 @@ public slots:
     void cancelTransfer(int transferId);
     void restartTransfer(int transferId);
     void dumpMemoryInfo(const QString &fileName);
+    void dumpDatabaseStatistics(const QString &fileName);
+    bool backupDatabase(const QString &path);
 private:
     BrowserService *m_BrowserService;
 };
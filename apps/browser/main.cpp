@@ -78,6 +78,16 @@ Q_DECL_EXPORT int main(int argc, char *argv[])
             message = QDBusMessage::createMethodCall(service->serviceName(), "/",
                                                      service->serviceName(), "dumpMemoryInfo");
             message.setArguments(QVariantList() << fileName);
+        } else if (app->arguments().contains("-dumpDatabaseStatistics")) {
+            int index = app->arguments().indexOf("-dumpDatabaseStatistics");
+            QString fileName;
+            if (index + 1 < app->arguments().size()) {
+                fileName = app->arguments().at(index + 1);
+            }
+
+            message = QDBusMessage::createMethodCall(service->serviceName(), "/",
+                                                     service->serviceName(), "dumpDatabaseStatistics");
+            message.setArguments(QVariantList() << fileName);
         } else {
             message = QDBusMessage::createMethodCall(service->serviceName(), "/",
                                                      service->serviceName(), "openUrl");
@@ -146,6 +156,12 @@ Q_DECL_EXPORT int main(int argc, char *argv[])
                      browser, &Browser::openNewTabView);
     browser->connect(service, &BrowserService::dumpMemoryInfoRequested,
                      browser, &Browser::dumpMemoryInfo);
+    browser->connect(service, &BrowserService::dumpDatabaseStatisticsRequested,
+                     browser, &Browser::dumpDatabaseStatistics);
+    browser->connect(service, &BrowserService::backupDatabaseRequested,
+                     browser, &Browser::backupDatabase);
+    browser->connect(browser, &Browser::databaseBackupFinished,
+                     service, &BrowserService::databaseBackupFinished);
 
     if (uiService)
     {
@@ -12,7 +12,9 @@
 
 #include "browser.h"
 #include "browser_p.h"
+#include "browserpaths.h"
 #include "closeeventfilter.h"
+#include "dbmanager.h"
 #include "declarativewebutils.h"
 #include "downloadmanager.h"
 #include "settingmanager.h"
@@ -20,11 +22,14 @@
 
 #include <QDir>
 #include <QGuiApplication>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QQmlContext>
 #include <QQuickView>
 #include <QTimer>
 #include <QUrl>
 #include <QDebug>
+#include <MGConfItem>
 #include <webengine.h>
 #include <webenginesettings.h>
 #include <browserapp.h>
@@ -90,6 +95,14 @@ Browser::Browser(QQuickView *view, QObject *parent)
     d->view->rootContext()->setContextProperty("Settings", SettingManager::instance());
     d->view->rootContext()->setContextProperty("DownloadManager", downloadManager);
 
+    // Statement timing is a debugging aid, it costs a check per statement
+    // when disabled.
+    if (qGuiApp->arguments().contains(QStringLiteral("-debugMode"))) {
+        MGConfItem slowQueryThreshold("/apps/sailfish-browser/settings/slow_query_threshold");
+        DBManager::instance()->setStatementProfiling(
+                    true, slowQueryThreshold.value(DEFAULT_SLOW_QUERY_THRESHOLD).toInt());
+    }
+
     d->closeEventFilter = new CloseEventFilter(downloadManager, this);
     d->view->installEventFilter(d->closeEventFilter);
 
@@ -165,3 +178,41 @@ void Browser::dumpMemoryInfo(const QString &fileName)
 {
     DeclarativeWebUtils::instance()->handleDumpMemoryInfoRequest(fileName);
 }
+
+// Writes the statement profile as JSON, only available in debug mode.
+void Browser::dumpDatabaseStatistics(const QString &fileName)
+{
+    if (!qGuiApp->arguments().contains(QStringLiteral("-debugMode"))) {
+        return;
+    }
+
+    QString filePath = fileName;
+    if (filePath.isEmpty()) {
+        filePath = QDir(BrowserPaths::cacheLocation()).absoluteFilePath(QStringLiteral("database-statistics.json"));
+    }
+
+    QFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Failed to write database statistics to" << filePath << file.errorString();
+        return;
+    }
+
+    QVariantMap statistics = DBManager::instance()->statementProfile();
+    statistics.insert(QStringLiteral("search"), DBManager::instance()->searchStatistics());
+    file.write(QJsonDocument(QJsonObject::fromVariantMap(statistics)).toJson());
+    qDebug() << "Database statistics written to" << filePath;
+}
+
+// Copies the database without stopping the browser, used by the backup unit
+void Browser::backupDatabase(const QString &path)
+{
+    if (BrowserApp::captivePortal()) {
+        emit databaseBackupFinished(path, false);
+        return;
+    }
+
+    DBManager *manager = DBManager::instance();
+    connect(manager, &DBManager::backupFinished,
+            this, &Browser::databaseBackupFinished, Qt::UniqueConnection);
+    manager->backup(path);
+}
@@ -41,6 +41,12 @@ public slots:
 
     // Debug helpers
     void dumpMemoryInfo(const QString &fileName);
+    void dumpDatabaseStatistics(const QString &fileName);
+
+    void backupDatabase(const QString &path);
+
+signals:
+    void databaseBackupFinished(const QString &path, bool ok);
 
 private:
     BrowserPrivate *d_ptr;
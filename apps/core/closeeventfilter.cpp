@@ -32,7 +32,7 @@ void CloseEventFilter::stopApplication()
 {
     MGConfItem closeAllTabsConf("/apps/sailfish-browser/settings/close_all_tabs");
     if (closeAllTabsConf.value(false).toBool()) {
-        DBManager::instance()->removeAllTabs();
+        m_removeAllTabsWatcher.setFuture(DBManager::instance()->removeAllTabs());
     }
 
     SailfishOS::WebEngine::instance()->stopEmbedding();
@@ -53,6 +53,12 @@ void CloseEventFilter::onLastWindowDestroyed()
 
 void CloseEventFilter::onContextDestroyed()
 {
+    // Tabs are removed in the background, don't exit before they are gone.
+    if (!m_removeAllTabsWatcher.isFinished()) {
+        connect(&m_removeAllTabsWatcher, &QFutureWatcher<void>::finished,
+                qApp, &QCoreApplication::quit);
+        return;
+    }
     qApp->exit();
 }
 
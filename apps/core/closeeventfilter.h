@@ -14,6 +14,7 @@
 
 #include <QObject>
 #include <QEvent>
+#include <QFutureWatcher>
 #include <QTimer>
 #include "downloadmanager.h"
 
@@ -36,6 +37,7 @@ private slots:
 private:
     DownloadManager *m_downloadManager;
     QTimer m_shutdownWatchdog;
+    QFutureWatcher<void> m_removeAllTabsWatcher;
 };
 
 #endif
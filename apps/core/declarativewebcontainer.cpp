@@ -90,9 +90,14 @@ DeclarativeWebContainer::DeclarativeWebContainer(QWindow *parent)
     connect(this, &DeclarativeWebContainer::webPageComponentChanged,
             pageFactory, &WebPageFactory::updateQmlComponent);
     m_webPages = new WebPages(pageFactory, this);
-    int maxTabid = DBManager::instance()->getMaxTabId();
-    m_persistentTabModel = new PersistentTabModel(maxTabid + 1, this);
-    m_privateTabModel = new PrivateTabModel(maxTabid + 1001, this);
+    // The persistent model starts after the tabs of the session snapshot and
+    // the private model well clear of them. Both move past the stored tab ids
+    // once the largest one is known, see onMaxTabIdAvailable().
+    m_persistentTabModel = new PersistentTabModel(1, this);
+    m_privateTabModel = new PrivateTabModel(m_persistentTabModel->nextTabId() + 1000, this);
+    connect(&m_maxTabIdWatcher, &QFutureWatcher<int>::finished,
+            this, &DeclarativeWebContainer::onMaxTabIdAvailable);
+    m_maxTabIdWatcher.setFuture(DBManager::instance()->getMaxTabId());
 
     setTabModel((BrowserApp::captivePortal() || m_privateMode) ? m_privateTabModel.data() : m_persistentTabModel.data());
 
@@ -111,6 +116,9 @@ DeclarativeWebContainer::DeclarativeWebContainer(QWindow *parent)
 
     connect(this, &DeclarativeWebContainer::foregroundChanged,
             this, &DeclarativeWebContainer::updateWindowFlags);
+    connect(this, &DeclarativeWebContainer::foregroundChanged,
+            this, &DeclarativeWebContainer::updateDatabaseMaintenance);
+    updateDatabaseMaintenance();
 
     qApp->installEventFilter(this);
 
@@ -491,6 +499,13 @@ void DeclarativeWebContainer::goBack()
     }
 }
 
+void DeclarativeWebContainer::onMaxTabIdAvailable()
+{
+    int maxTabId = m_maxTabIdWatcher.result();
+    m_persistentTabModel->reserveTabIds(maxTabId);
+    m_privateTabModel->reserveTabIds(maxTabId + 1000);
+}
+
 void DeclarativeWebContainer::closeTab(int tabId)
 {
     m_model->removeTabById(tabId, false);
@@ -1030,6 +1045,12 @@ void DeclarativeWebContainer::updateWindowFlags()
     }
 }
 
+void DeclarativeWebContainer::updateDatabaseMaintenance()
+{
+    // Keep database maintenance out of the way while the browser is in use
+    DBManager::instance()->setMaintenanceAllowed(!m_foreground);
+}
+
 void DeclarativeWebContainer::updatePageFocus(bool focus)
 {
     if (m_webPage) {
@@ -222,8 +222,10 @@ private slots:
     void updateLoading();
     void updateActiveTabRendered();
     void onLastViewDestroyed();
+    void onMaxTabIdAvailable();
 
     void updateWindowFlags();
+    void updateDatabaseMaintenance();
 
     // QMozWindow related slots:
     void createGLContext();
@@ -261,6 +263,7 @@ private:
     QPointer<WebPages> m_webPages;
     QPointer<DeclarativeTabModel> m_persistentTabModel;
     QPointer<DeclarativeTabModel> m_privateTabModel;
+    QFutureWatcher<int> m_maxTabIdWatcher;
 
     bool m_enabled;
     bool m_foreground;
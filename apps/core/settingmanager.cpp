@@ -11,6 +11,7 @@
 
 #include "settingmanager.h"
 #include "dbmanager.h"
+#include "historylimits.h"
 #include "opensearchconfigs.h"
 
 #include <MGConfItem>
@@ -34,6 +35,8 @@ SettingManager::SettingManager(QObject *parent)
     m_searchEngineConfItem = new MGConfItem("/apps/sailfish-browser/settings/search_engine", this);
     m_doNotTrackConfItem = new MGConfItem("/apps/sailfish-browser/settings/do_not_track", this);
     m_autostartPrivateBrowsing = new MGConfItem("/apps/sailfish-browser/settings/autostart_private_browsing", this);
+    m_historyMaxEntriesConfItem = new MGConfItem("/apps/sailfish-browser/settings/history_max_entries", this);
+    m_historyMaxBytesConfItem = new MGConfItem("/apps/sailfish-browser/settings/history_max_bytes", this);
 
     // Look and feel related settings
     m_toolbarSmall = new MGConfItem("/apps/sailfish-browser/settings/toolbar_small", this);
@@ -62,6 +65,7 @@ bool SettingManager::initialize()
 
     setSearchEngine();
     doNotTrack();
+    setHistoryLimits();
 
     connect(m_clearHistoryConfItem, &MGConfItem::valueChanged,
             this, &SettingManager::clearHistory);
@@ -75,6 +79,10 @@ bool SettingManager::initialize()
             this, &SettingManager::setSearchEngine);
     connect(m_doNotTrackConfItem, &MGConfItem::valueChanged,
             this, &SettingManager::doNotTrack);
+    connect(m_historyMaxEntriesConfItem, &MGConfItem::valueChanged,
+            this, &SettingManager::setHistoryLimits);
+    connect(m_historyMaxBytesConfItem, &MGConfItem::valueChanged,
+            this, &SettingManager::setHistoryLimits);
 
     m_initialized = true;
     return clearedData;
@@ -161,6 +169,12 @@ void SettingManager::doNotTrack()
                                      m_doNotTrackConfItem->value(false));
 }
 
+void SettingManager::setHistoryLimits()
+{
+    DBManager::instance()->setHistoryLimits(m_historyMaxEntriesConfItem->value(DEFAULT_HISTORY_MAX_ENTRIES).toInt(),
+                                            m_historyMaxBytesConfItem->value(DEFAULT_HISTORY_MAX_BYTES).toLongLong());
+}
+
 void SettingManager::handleObserve(const QString &message, const QVariant &data)
 {
     const QVariantMap dataMap = data.toMap();
@@ -45,6 +45,7 @@ private slots:
     bool clearCache();
     void setSearchEngine();
     void doNotTrack();
+    void setHistoryLimits();
     void handleObserve(const QString &message, const QVariant &data);
 
 private:
@@ -57,6 +58,8 @@ private:
     MGConfItem *m_searchEngineConfItem;
     MGConfItem *m_doNotTrackConfItem;
     MGConfItem *m_autostartPrivateBrowsing;
+    MGConfItem *m_historyMaxEntriesConfItem;
+    MGConfItem *m_historyMaxBytesConfItem;
 
     MGConfItem *m_toolbarSmall;
     MGConfItem *m_toolbarLarge;
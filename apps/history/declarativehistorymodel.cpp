@@ -15,9 +15,13 @@
 
 DeclarativeHistoryModel::DeclarativeHistoryModel(QObject *parent)
     : QAbstractListModel(parent)
+    , m_canFetchMore(false)
+    , m_fetching(false)
 {
     connect(DBManager::instance(), &DBManager::historyAvailable,
             this, &DeclarativeHistoryModel::historyAvailable);
+    connect(DBManager::instance(), &DBManager::moreHistoryAvailable,
+            this, &DeclarativeHistoryModel::moreHistoryAvailable);
     connect(DBManager::instance(), &DBManager::titleChanged,
             this, &DeclarativeHistoryModel::updateTitle);
 }
@@ -68,6 +72,8 @@ void DeclarativeHistoryModel::remove(const QString &url)
 
 void DeclarativeHistoryModel::search(const QString &filter)
 {
+    m_filter = filter;
+    m_fetching = false;
     DBManager::instance()->getHistory(filter);
 }
 
@@ -94,6 +100,26 @@ QVariant DeclarativeHistoryModel::data(const QModelIndex & index, int role) cons
     }
 }
 
+bool DeclarativeHistoryModel::canFetchMore(const QModelIndex &parent) const
+{
+    if (parent.isValid()) {
+        return false;
+    }
+    return m_canFetchMore && !m_fetching && !m_links.isEmpty();
+}
+
+void DeclarativeHistoryModel::fetchMore(const QModelIndex &parent)
+{
+    if (!canFetchMore(parent)) {
+        return;
+    }
+
+    // Next page continues after the last row that we have
+    m_fetching = true;
+    const Link &last = m_links.last();
+    DBManager::instance()->getMoreHistory(m_filter, last.linkId(), last.sortKey());
+}
+
 void DeclarativeHistoryModel::componentComplete()
 {
     search("");
@@ -108,6 +134,31 @@ void DeclarativeHistoryModel::historyAvailable(QList<Link> linkList)
     // DBWorker suppresses history (distinct select). Thus, id and thumbnailPath of
     // every link is the same.
     updateModel(linkList);
+    m_canFetchMore = linkList.count() >= DBManager::historyPageSize();
+}
+
+void DeclarativeHistoryModel::moreHistoryAvailable(const QString &filter, int afterLinkId, QList<Link> linkList)
+{
+    if (filter != m_filter) {
+        return;
+    }
+
+    m_fetching = false;
+    // Rows have changed since the page was requested, e.g. the last one was
+    // removed. Drop the page, the view asks for it again.
+    if (m_links.isEmpty() || m_links.last().linkId() != afterLinkId) {
+        return;
+    }
+
+    m_canFetchMore = linkList.count() >= DBManager::historyPageSize();
+    if (linkList.isEmpty()) {
+        return;
+    }
+
+    beginInsertRows(QModelIndex(), m_links.count(), m_links.count() + linkList.count() - 1);
+    m_links.append(linkList);
+    endInsertRows();
+    emit countChanged();
 }
 
 void DeclarativeHistoryModel::updateModel(QList<Link> linkList)
@@ -42,6 +42,8 @@ public:
     int rowCount(const QModelIndex & parent = QModelIndex()) const;
     QVariant data(const QModelIndex & index, int role = Qt::DisplayRole) const;
     QHash<int, QByteArray> roleNames() const;
+    bool canFetchMore(const QModelIndex &parent) const;
+    void fetchMore(const QModelIndex &parent);
 
     // From QQmlParserStatus
     void classBegin();
@@ -52,12 +54,16 @@ signals:
 
 private slots:
     void historyAvailable(QList<Link> linkList);
+    void moreHistoryAvailable(const QString &filter, int afterLinkId, QList<Link> linkList);
     void updateTitle(const QString &url, const QString &title);
 
 private:
     void updateModel(QList<Link> linkList);
 
     QList<Link> m_links;
+    QString m_filter;
+    bool m_canFetchMore;
+    bool m_fetching;
 
     friend class tst_declarativehistorymodel;
     friend class tst_webview;
@@ -76,6 +76,14 @@ int DeclarativeTabModel::nextTabId() const
     return m_nextTabId;
 }
 
+// Tab ids up to lastTabId are in use elsewhere, new tabs get ids after it.
+void DeclarativeTabModel::reserveTabIds(int lastTabId)
+{
+    if (m_nextTabId <= lastTabId) {
+        m_nextTabId = lastTabId + 1;
+    }
+}
+
 void DeclarativeTabModel::remove(int index) {
     if (!m_tabs.isEmpty() && index >= 0 && index < m_tabs.count()) {
         bool removingActiveTab = activeTabIndex() == index;
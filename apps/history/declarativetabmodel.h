@@ -64,6 +64,7 @@ public:
     QHash<int, QByteArray> roleNames() const;
 
     int nextTabId() const;
+    void reserveTabIds(int lastTabId);
 
     bool loaded() const;
     void setUnloaded();
@@ -14,30 +14,129 @@
 #include "declarativewebcontainer.h"
 #include "persistenttabmodel.h"
 #include "dbmanager.h"
+#include "sessionsnapshot.h"
+
+#ifndef DEBUG_LOGS
+#define DEBUG_LOGS 0
+#endif
+
+// Delay between a tab change and rewriting the session snapshot, in milliseconds.
+#define SNAPSHOT_SAVE_DELAY 500
+
+// Time from the first title change of a tab to writing its latest title, in
+// milliseconds.
+#define TITLE_WRITE_DELAY 1000
+
+static int maxTabId(const QList<Tab> &tabs)
+{
+    int maxTabId(0);
+    foreach (const Tab &tab, tabs) {
+        if (maxTabId < tab.tabId()) {
+            maxTabId = tab.tabId();
+        }
+    }
+    return maxTabId;
+}
 
 PersistentTabModel::PersistentTabModel(int nextTabId, DeclarativeWebContainer *webContainer)
     : DeclarativeTabModel(nextTabId, webContainer)
+    , m_snapshotTimer(this)
+    , m_titleTimer(this)
+    , m_restored(false)
+    , m_changedSinceRestore(false)
 {
+    // Titles and urls change in bursts while pages load, the snapshot is
+    // rewritten at most once per interval.
+    m_snapshotTimer.setSingleShot(true);
+    m_snapshotTimer.setInterval(SNAPSHOT_SAVE_DELAY);
+    connect(&m_snapshotTimer, &QTimer::timeout, this, &PersistentTabModel::saveSnapshot);
+    m_titleTimer.setSingleShot(true);
+    connect(&m_titleTimer, &QTimer::timeout, this, &PersistentTabModel::writeTitles);
+    m_titleClock.start();
+    connect(this, &PersistentTabModel::activeTabIndexChanged,
+            this, &PersistentTabModel::scheduleSnapshot);
+
     connect(DBManager::instance(), &DBManager::tabsAvailable,
             this, &PersistentTabModel::tabsAvailable);
 
+    restoreSnapshot();
     DBManager::instance()->getAllTabs();
 }
 
 PersistentTabModel::~PersistentTabModel()
 {
+    while (!m_pendingTitles.isEmpty()) {
+        writeTitle(m_pendingTitles.constBegin().key());
+    }
+    if (m_snapshotTimer.isActive()) {
+        saveSnapshot();
+    }
+}
+
+// Populates the model synchronously so that the active tab can be loaded
+// without waiting for the database, tabsAvailable() reconciles later.
+void PersistentTabModel::restoreSnapshot()
+{
+    QList<Tab> tabs;
+    int activeTabId = 0;
+    if (!SessionSnapshot::load(&tabs, &activeTabId)) {
+        return;
+    }
+
+    m_tabs = tabs;
+    if (!m_tabs.isEmpty()) {
+        m_activeTabId = findTabIndex(activeTabId) >= 0 ? activeTabId : m_tabs.at(0).tabId();
+    }
+    reserveTabIds(maxTabId(tabs));
+
+    m_restored = true;
+    m_loaded = true;
+
+    connect(this, &PersistentTabModel::activeTabIndexChanged,
+            this, &PersistentTabModel::saveActiveTab, Qt::UniqueConnection);
 }
 
 void PersistentTabModel::tabsAvailable(const QList<Tab> &tabs)
 {
+    bool reconcile = m_restored;
+    if (m_restored) {
+        m_restored = false;
+        // Changes made to the restored tabs were queued after the query of
+        // these tabs, thus the model is newer than the list. Tabs that only
+        // the database knows were missed by the snapshot and are added.
+        if (m_changedSinceRestore || tabs == m_tabs) {
+            mergeTabs(tabs);
+            m_removedSinceRestore.clear();
+            reserveTabIds(maxTabId(tabs));
+            if (!m_loaded) {
+                m_loaded = true;
+                emit loadedChanged();
+            }
+            return;
+        }
+        m_removedSinceRestore.clear();
+#if DEBUG_LOGS
+        qDebug() << "session snapshot out of date, resetting" << m_tabs.count() << "tabs to" << tabs.count();
+#endif
+    }
+
+    int oldActiveTabId = m_activeTabId;
     beginResetModel();
     int oldCount = count();
 
-    // Clear always previous tabs
-    clear();
+    // Clear always previous tabs. Restored tabs that the database does not
+    // know are dropped from the model only.
+    if (reconcile) {
+        m_tabs.clear();
+        m_activeTabId = 0;
+    } else {
+        clear();
+    }
 
     if (tabs.count() > 0) {
         m_tabs = tabs;
+        // Tabs are queried after the database has been opened, thus the
+        // settings snapshot of DBManager is already loaded.
         QString activeTabId = DBManager::instance()->getSetting("activeTabId");
         bool ok = false;
         int tabId = activeTabId.toInt(&ok);
@@ -57,15 +156,9 @@ void PersistentTabModel::tabsAvailable(const QList<Tab> &tabs)
         emit countChanged();
     }
 
-    int maxTabId(0);
-    foreach (const Tab &tab, tabs) {
-        if (maxTabId < tab.tabId()) {
-            maxTabId = tab.tabId();
-        }
-    }
-
-    if (m_nextTabId != maxTabId + 1) {
-        m_nextTabId = maxTabId + 1;
+    int lastTabId = maxTabId(tabs);
+    if (m_nextTabId != lastTabId + 1) {
+        m_nextTabId = lastTabId + 1;
     }
 
     // Startup should be synced to this.
@@ -76,35 +169,142 @@ void PersistentTabModel::tabsAvailable(const QList<Tab> &tabs)
 
     connect(this, &PersistentTabModel::activeTabIndexChanged,
             this, &PersistentTabModel::saveActiveTab, Qt::UniqueConnection);
+
+    // The web container already loaded the active tab of the snapshot.
+    if (reconcile && m_activeTabId != oldActiveTabId) {
+        emit activeTabChanged(m_activeTabId);
+    }
+    scheduleSnapshot();
+}
+
+// Appends the tabs that are neither in the model nor closed since the
+// snapshot was restored.
+void PersistentTabModel::mergeTabs(const QList<Tab> &tabs)
+{
+    QList<Tab> missing;
+    foreach (const Tab &tab, tabs) {
+        if (findTabIndex(tab.tabId()) < 0 && !m_removedSinceRestore.contains(tab.tabId())) {
+            missing.append(tab);
+        }
+    }
+    if (missing.isEmpty()) {
+        return;
+    }
+
+#if DEBUG_LOGS
+    qDebug() << "adding" << missing.count() << "tabs missing from the session snapshot";
+#endif
+    beginInsertRows(QModelIndex(), m_tabs.count(), m_tabs.count() + missing.count() - 1);
+    m_tabs.append(missing);
+    endInsertRows();
+    emit countChanged();
+    scheduleSnapshot();
 }
 
 void PersistentTabModel::createTab(const Tab &tab) {
     DBManager::instance()->createTab(tab);
+    scheduleSnapshot();
 }
 
+// Pages change their title repeatedly while loading and some keep animating
+// it. Only the latest title of a page within the write delay is stored, the
+// model itself has been updated already.
 void PersistentTabModel::updateTitle(int tabId, const QString &url, const QString &title)
 {
-    DBManager::instance()->updateTitle(tabId, url, title);
+    QHash<int, PendingTitle>::iterator pending = m_pendingTitles.find(tabId);
+    if (pending != m_pendingTitles.end() && pending->url != url) {
+        // The previous page keeps its last title
+        writeTitle(tabId);
+        pending = m_pendingTitles.end();
+    }
+
+    if (pending == m_pendingTitles.end()) {
+        PendingTitle pendingTitle;
+        pendingTitle.url = url;
+        pendingTitle.deadline = m_titleClock.elapsed() + TITLE_WRITE_DELAY;
+        pending = m_pendingTitles.insert(tabId, pendingTitle);
+        if (!m_titleTimer.isActive()) {
+            m_titleTimer.start(TITLE_WRITE_DELAY);
+        }
+    }
+    pending->title = title;
+    scheduleSnapshot();
+}
+
+// Writes the titles whose delay has passed and waits for the next one
+void PersistentTabModel::writeTitles()
+{
+    const qint64 now = m_titleClock.elapsed();
+    qint64 next = -1;
+    QHash<int, PendingTitle>::iterator pending = m_pendingTitles.begin();
+    while (pending != m_pendingTitles.end()) {
+        if (pending->deadline <= now) {
+            DBManager::instance()->updateTitle(pending.key(), pending->url, pending->title);
+            pending = m_pendingTitles.erase(pending);
+        } else {
+            next = next < 0 ? pending->deadline : qMin(next, pending->deadline);
+            ++pending;
+        }
+    }
+
+    if (next >= 0) {
+        m_titleTimer.start(next - now);
+    }
+}
+
+void PersistentTabModel::writeTitle(int tabId)
+{
+    QHash<int, PendingTitle>::iterator pending = m_pendingTitles.find(tabId);
+    if (pending != m_pendingTitles.end()) {
+        DBManager::instance()->updateTitle(tabId, pending->url, pending->title);
+        m_pendingTitles.erase(pending);
+    }
 }
 
 void PersistentTabModel::removeTab(int tabId)
 {
+    // The title still goes to the browsing history
+    writeTitle(tabId);
+    if (m_restored) {
+        m_removedSinceRestore.insert(tabId);
+    }
     DBManager::instance()->removeTab(tabId);
+    scheduleSnapshot();
 }
 
 void PersistentTabModel::navigateTo(int tabId, const QString &url, const QString &title, const QString &path) {
     Q_UNUSED(title)
     Q_UNUSED(path)
 
+    // The title of the previous page is stored before leaving it
+    writeTitle(tabId);
     DBManager::instance()->navigateTo(tabId, url, "", "");
+    scheduleSnapshot();
 }
 
 void PersistentTabModel::updateThumbPath(int tabId, const QString &path)
 {
     DBManager::instance()->updateThumbPath(tabId, path);
+    scheduleSnapshot();
 }
 
 void PersistentTabModel::saveActiveTab() const
 {
     DBManager::instance()->saveSetting("activeTabId", QString("%1").arg(m_activeTabId));
 }
+
+void PersistentTabModel::scheduleSnapshot()
+{
+    if (m_restored) {
+        m_changedSinceRestore = true;
+    }
+    if (!m_snapshotTimer.isActive()) {
+        m_snapshotTimer.start();
+    }
+}
+
+void PersistentTabModel::saveSnapshot()
+{
+    m_snapshotTimer.stop();
+    DBManager::instance()->saveSession(m_tabs, m_activeTabId);
+}
@@ -12,6 +12,11 @@
 #ifndef PERSISTENTTABMODEL_H
 #define PERSISTENTTABMODEL_H
 
+#include <QElapsedTimer>
+#include <QHash>
+#include <QSet>
+#include <QTimer>
+
 #include "declarativetabmodel.h"
 
 class DeclarativeWebContainer;
@@ -30,10 +35,35 @@ protected:
 private slots:
     void saveActiveTab() const;
     void tabsAvailable(const QList<Tab> &tabs);
+    void saveSnapshot();
+    void writeTitles();
 
 public:
     PersistentTabModel(int nextTabId, DeclarativeWebContainer *webContainer = 0);
     ~PersistentTabModel();
+
+private:
+    void restoreSnapshot();
+    void scheduleSnapshot();
+    void mergeTabs(const QList<Tab> &tabs);
+    void writeTitle(int tabId);
+
+    // Title of a tab waiting to be written, see updateTitle()
+    struct PendingTitle {
+        QString url;
+        QString title;
+        qint64 deadline;
+    };
+
+    QTimer m_snapshotTimer;
+    QHash<int, PendingTitle> m_pendingTitles;
+    QTimer m_titleTimer;
+    QElapsedTimer m_titleClock;
+    // Tabs were restored from the session snapshot and the database has not
+    // reported its tabs yet.
+    bool m_restored;
+    bool m_changedSinceRestore;
+    QSet<int> m_removedSinceRestore;
 };
 
 #endif // PERSISTENTTABMODEL_H
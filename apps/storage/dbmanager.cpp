@@ -11,10 +11,50 @@
 
 #include "dbmanager.h"
 
+#include <QCoreApplication>
+#include <QDebug>
+#include <QFutureInterface>
 #include <QMetaObject>
+#include <limits>
 
 #include "dbworker.h"
 
+#ifndef DEBUG_LOGS
+#define DEBUG_LOGS 0
+#endif
+
+// Runs function on the thread of worker, the future carries its return value.
+// done is called once the future has finished.
+template <typename T>
+static QFuture<T> runTask(DBWorker *worker, const std::function<T()> &function,
+                          const std::function<void()> &done, TaskPriority priority, quint64 sequence)
+{
+    QFutureInterface<T> result;
+    result.reportStarted();
+    worker->post(new DBTask([result, function, done]() mutable {
+        T value = function();
+        result.reportFinished(&value);
+        done();
+    }, priority, sequence));
+    return result.future();
+}
+
+static QFuture<void> runTask(DBWorker *worker, const std::function<void()> &function,
+                             const std::function<void()> &done, TaskPriority priority, quint64 sequence)
+{
+    QFutureInterface<void> result;
+    result.reportStarted();
+    worker->post(new DBTask([result, function, done]() mutable {
+        function();
+        result.reportFinished();
+        done();
+    }, priority, sequence));
+    return result.future();
+}
+
+// Delay for coalescing setting changes, in milliseconds
+#define SETTINGS_WRITE_DELAY 1000
+
 static DBManager *gDbManager = 0;
 
 DBManager *DBManager::instance()
@@ -25,129 +65,478 @@ DBManager *DBManager::instance()
     return gDbManager;
 }
 
+QFuture<void> DBManager::write(const std::function<void()> &function)
+{
+    const quint64 ticket = ++m_lastTicket;
+    m_lastWriteTicket = ticket;
+    m_writerTickets.enqueue(ticket);
+
+    DBManager *manager = this;
+    DBWorker *dbWorker = worker;
+    return runTask(worker, [dbWorker, ticket, function]() {
+        function();
+        dbWorker->finishWrite(ticket);
+    }, [manager]() {
+        QMetaObject::invokeMethod(manager, "writeDone", Qt::QueuedConnection);
+    }, UserVisiblePriority, ticket);
+}
+
+template <typename T>
+QFuture<T> DBManager::write(const std::function<T()> &function)
+{
+    const quint64 ticket = ++m_lastTicket;
+    m_lastWriteTicket = ticket;
+    m_writerTickets.enqueue(ticket);
+
+    DBManager *manager = this;
+    DBWorker *dbWorker = worker;
+    return runTask<T>(worker, [dbWorker, ticket, function]() {
+        T value = function();
+        dbWorker->finishWrite(ticket);
+        return value;
+    }, [manager]() {
+        QMetaObject::invokeMethod(manager, "writeDone", Qt::QueuedConnection);
+    }, UserVisiblePriority, ticket);
+}
+
+// Background calls run on the writer once it has nothing else to do, in call
+// order among themselves. Queries on the reader do not wait for them and
+// their signals are not held back, calls reading what they write on the
+// writer get them run first.
+QFuture<void> DBManager::background(const std::function<void()> &function)
+{
+    return runTask(worker, function, []() {}, BackgroundPriority, ++m_lastTicket);
+}
+
+QFuture<void> DBManager::read(const std::function<void()> &function)
+{
+    const quint64 ticket = ++m_lastTicket;
+    const quint64 lastWriteTicket = m_lastWriteTicket;
+    m_readerTickets.enqueue(ticket);
+
+    DBManager *manager = this;
+    DBWorker *dbReader = reader;
+    return runTask(reader, [dbReader, lastWriteTicket, function]() {
+        dbReader->beginRead(lastWriteTicket);
+        function();
+        dbReader->endRead();
+    }, [manager]() {
+        QMetaObject::invokeMethod(manager, "readDone", Qt::QueuedConnection);
+    }, UserVisiblePriority, ticket);
+}
+
 DBManager::DBManager(QObject *parent)
     : QObject(parent)
+    , m_loaded(false)
+    , m_settingsTimer(this)
+    , m_searchGeneration(0)
+    , m_searchRequests(0)
+    , m_completedSearches(0)
+    , m_lastSearchLatency(0)
+    , m_maxSearchLatency(0)
+    , m_totalSearchLatency(0)
+    , m_lastTicket(0)
+    , m_lastWriteTicket(0)
 {
     qRegisterMetaType<QList<Tab> >("QList<Tab>");
     qRegisterMetaType<QList<Link> >("QList<Link>");
     qRegisterMetaType<Tab>("Tab");
 
     worker = new DBWorker();
+    worker->setWriteBarrier(&m_writeBarrier);
+    worker->setStatementProfiler(&m_profiler);
     worker->moveToThread(&workerThread);
-
     connect(&workerThread, &QThread::finished, worker, &DBWorker::deleteLater);
-    connect(worker, &DBWorker::tabsAvailable, this, &DBManager::tabsAvailable);
-    connect(worker, &DBWorker::historyAvailable, this, &DBManager::historyAvailable);
-    connect(worker, &DBWorker::tabHistoryAvailable, this, &DBManager::tabHistoryAvailable);
-    connect(worker, &DBWorker::titleChanged, this, &DBManager::titleChanged);
-    connect(worker, &DBWorker::thumbPathChanged, this, &DBManager::thumbPathChanged);
+    connectWorker(worker, &m_writerTickets);
+
+    reader = new DBWorker();
+    reader->setWriteBarrier(&m_writeBarrier);
+    reader->setStatementProfiler(&m_profiler);
+    reader->setSearchGeneration(&m_searchGeneration);
+    reader->setSearchCache(&m_searchCache);
+    reader->moveToThread(&readerThread);
+    connect(&readerThread, &QThread::finished, reader, &DBWorker::deleteLater);
+    connectWorker(reader, &m_readerTickets);
+
     workerThread.start();
+    readerThread.start();
+
+    m_settingsTimer.setSingleShot(true);
+    m_settingsTimer.setInterval(SETTINGS_WRITE_DELAY);
+    connect(&m_settingsTimer, &QTimer::timeout, this, &DBManager::flushSettings);
+    if (QCoreApplication::instance()) {
+        connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit,
+                this, &DBManager::finishWrites);
+    }
 
-    QMetaObject::invokeMethod(worker, "init", Qt::BlockingQueuedConnection);
-    QMetaObject::invokeMethod(worker, "getSettings", Qt::BlockingQueuedConnection,
-                              Q_RETURN_ARG(SettingsMap, m_settings));
+    // Opening and migrating a large database takes a while, don't hold
+    // the caller for it. Queries wait for this like for any other write.
+    connect(&m_loadWatcher, &QFutureWatcher<SettingsMap>::finished,
+            this, &DBManager::settingsLoaded);
+    DBWorker *dbWorker = worker;
+    m_loadWatcher.setFuture(write<SettingsMap>([dbWorker]() {
+        dbWorker->init();
+        return dbWorker->getSettings();
+    }));
 }
 
 DBManager::~DBManager()
 {
+    finishWrites();
     workerThread.exit();
+    readerThread.exit();
     // Use timeout of 500ms to guaranty we won't block
     workerThread.wait(500);
+    readerThread.wait(500);
     gDbManager = 0;
     foreach (QString connectionName, QSqlDatabase::connectionNames()) {
         QSqlDatabase::removeDatabase(connectionName);
     }
 }
 
-int DBManager::getMaxTabId()
+void DBManager::finishWrites()
 {
-    int maxTabId;
-    QMetaObject::invokeMethod(worker, "getMaxTabId", Qt::BlockingQueuedConnection,
-                              Q_RETURN_ARG(int, maxTabId));
-    return maxTabId;
+    flushSettings();
+    // Commit the writes still pending in the current batch, this also
+    // releases the reader if it waits for them.
+    QMetaObject::invokeMethod(worker, "runBackgroundTasks", Qt::BlockingQueuedConnection);
+    QMetaObject::invokeMethod(worker, "flush", Qt::BlockingQueuedConnection);
 }
 
-void DBManager::createTab(const Tab &tab)
+// Signals of a worker belong to the oldest call still running on it. Signals
+// of background calls go with the call running them or are emitted right away.
+void DBManager::connectWorker(DBWorker *dbWorker, const QQueue<quint64> *tickets)
 {
-    QMetaObject::invokeMethod(worker, "createTab", Qt::QueuedConnection,
-                              Q_ARG(Tab, tab));
+    connect(dbWorker, &DBWorker::tabsAvailable, this, [this, tickets](QList<Tab> tabs) {
+        deliver(tickets, [this, tabs]() { emit tabsAvailable(tabs); });
+    });
+    connect(dbWorker, &DBWorker::historyAvailable, this, [this, tickets](QList<Link> links, int generation) {
+        deliver(tickets, [this, links, generation]() {
+            // A newer search has been made since
+            if (generation != m_searchGeneration.load()) {
+                return;
+            }
+            searchDone();
+            emit historyAvailable(links);
+        });
+    });
+    // Not a search result, delivered whatever search was made before
+    connect(dbWorker, &DBWorker::historyCleared, this, [this, tickets]() {
+        deliver(tickets, [this]() { emit historyAvailable(QList<Link>()); });
+    });
+    connect(dbWorker, &DBWorker::moreHistoryAvailable, this,
+            [this, tickets](const QString &filter, int afterLinkId, QList<Link> links) {
+        deliver(tickets, [this, filter, afterLinkId, links]() { emit moreHistoryAvailable(filter, afterLinkId, links); });
+    });
+    connect(dbWorker, &DBWorker::tabHistoryAvailable, this,
+            [this, tickets](int tabId, QList<Link> links, int currentLinkId) {
+        deliver(tickets, [this, tabId, links, currentLinkId]() { emit tabHistoryAvailable(tabId, links, currentLinkId); });
+    });
+    connect(dbWorker, &DBWorker::titleChanged, this, [this, tickets](const QString &url, const QString &title) {
+        deliver(tickets, [this, url, title]() { emit titleChanged(url, title); });
+    });
+    connect(dbWorker, &DBWorker::thumbPathChanged, this, [this, tickets](int tabId, const QString &path) {
+        deliver(tickets, [this, tabId, path]() { emit thumbPathChanged(tabId, path); });
+    });
+    connect(dbWorker, &DBWorker::statisticsAvailable, this, [this, tickets](const QVariantMap &statistics) {
+        deliver(tickets, [this, statistics]() { emit statisticsAvailable(statistics); });
+    });
+    connect(dbWorker, &DBWorker::backupFinished, this, [this, tickets](const QString &path, bool ok) {
+        deliver(tickets, [this, path, ok]() { emit backupFinished(path, ok); });
+    });
 }
 
-void DBManager::navigateTo(int tabId, const QString &url, const QString &title, const QString &path)
+void DBManager::deliver(const QQueue<quint64> *tickets, const std::function<void()> &result)
 {
-    QMetaObject::invokeMethod(worker, "navigateTo", Qt::QueuedConnection,
-                              Q_ARG(int, tabId), Q_ARG(QString, url),
-                              Q_ARG(QString, title), Q_ARG(QString, path));
+    if (tickets->isEmpty()) {
+        // Not a result of a call, e.g. a timer on the worker
+        result();
+        return;
+    }
+
+    m_results[tickets->head()].append(result);
+    releaseResults();
+}
+
+void DBManager::releaseResults()
+{
+    quint64 oldestRunning = std::numeric_limits<quint64>::max();
+    if (!m_writerTickets.isEmpty()) {
+        oldestRunning = m_writerTickets.head();
+    }
+    if (!m_readerTickets.isEmpty()) {
+        oldestRunning = qMin(oldestRunning, m_readerTickets.head());
+    }
+
+    while (!m_results.isEmpty() && m_results.firstKey() <= oldestRunning) {
+        const QList<std::function<void()> > results = m_results.take(m_results.firstKey());
+        foreach (const std::function<void()> &result, results) {
+            result();
+        }
+    }
 }
 
-void DBManager::goForward(int tabId)
+void DBManager::writeDone()
 {
-    QMetaObject::invokeMethod(worker, "goForward", Qt::BlockingQueuedConnection,
-                              Q_ARG(int, tabId));
+    m_writerTickets.dequeue();
+    releaseResults();
 }
 
-void DBManager::goBack(int tabId)
+void DBManager::readDone()
 {
-    QMetaObject::invokeMethod(worker, "goBack", Qt::BlockingQueuedConnection,
-                              Q_ARG(int, tabId));
+    m_readerTickets.dequeue();
+    releaseResults();
 }
 
-void DBManager::getAllTabs()
+bool DBManager::isLoaded() const
 {
-    QMetaObject::invokeMethod(worker, "getAllTabs", Qt::QueuedConnection);
+    return m_loaded;
 }
 
-void DBManager::removeTab(int tabId)
+void DBManager::settingsLoaded()
 {
-    QMetaObject::invokeMethod(worker, "removeTab", Qt::QueuedConnection,
-                              Q_ARG(int, tabId));
+    SettingsMap settings = m_loadWatcher.result();
+    // Values set while loading are newer than the stored ones
+    for (SettingsMap::const_iterator it = settings.constBegin(); it != settings.constEnd(); ++it) {
+        if (!m_changedSettings.contains(it.key())) {
+            m_settings.insert(it.key(), it.value());
+        }
+    }
+    m_changedSettings.clear();
+    m_loaded = true;
+
+    emit settingsChanged();
+    emit loaded();
 }
 
-void DBManager::removeAllTabs()
+QFuture<int> DBManager::getMaxTabId()
 {
-    QMetaObject::invokeMethod(worker, "removeAllTabs", Qt::BlockingQueuedConnection,
-                              Q_ARG(bool, true));
+    DBWorker *dbWorker = worker;
+    return write<int>([dbWorker]() {
+        return dbWorker->getMaxTabId();
+    });
 }
 
-void DBManager::updateTitle(int tabId, const QString &url, const QString &title)
+QFuture<void> DBManager::getStatistics()
 {
-    QMetaObject::invokeMethod(worker, "updateTitle", Qt::QueuedConnection,
-                              Q_ARG(int, tabId), Q_ARG(QString, url), Q_ARG(QString, title));
+    DBWorker *dbWorker = worker;
+    return background([dbWorker]() {
+        dbWorker->getStatistics();
+    });
 }
 
-void DBManager::updateThumbPath(int tabId, const QString &path)
+// Writes a consistent copy of the database to path, replacing an existing file
+QFuture<void> DBManager::backup(const QString &path)
 {
-    QMetaObject::invokeMethod(worker, "updateThumbPath", Qt::QueuedConnection,
-                              Q_ARG(int, tabId), Q_ARG(QString, path));
+    DBWorker *dbWorker = worker;
+    return background([dbWorker, path]() {
+        dbWorker->backup(path);
+    });
 }
 
-void DBManager::removeHistoryEntry(int linkId)
+// Database maintenance runs while allowed, meant for when the browser is in
+// the background. Disallowing takes effect without waiting for queued calls.
+void DBManager::setMaintenanceAllowed(bool allowed)
 {
-    QMetaObject::invokeMethod(worker, "removeHistoryEntry", Qt::QueuedConnection,
-                              Q_ARG(int, linkId));
+    worker->setMaintenanceAllowed(allowed);
 }
 
-void DBManager::clearHistory()
+// Times the statements executed by the worker threads, executions taking
+// at least slowQueryThreshold milliseconds are logged.
+void DBManager::setStatementProfiling(bool enabled, int slowQueryThreshold)
 {
-    QMetaObject::invokeMethod(worker, "clearHistory", Qt::QueuedConnection);
+    m_profiler.setSlowQueryThreshold(slowQueryThreshold);
+    m_profiler.setEnabled(enabled);
 }
 
-void DBManager::getHistory(const QString &filter)
+QVariantMap DBManager::statementProfile() const
 {
-    QMetaObject::invokeMethod(worker, "getHistory", Qt::QueuedConnection, Q_ARG(QString, filter));
+    return m_profiler.statistics();
 }
 
-void DBManager::getTabHistory(int tabId)
+QFuture<void> DBManager::createTab(const Tab &tab)
 {
-    QMetaObject::invokeMethod(worker, "getTabHistory", Qt::QueuedConnection, Q_ARG(int, tabId));
+    DBWorker *dbWorker = worker;
+    return write([dbWorker, tab]() {
+        dbWorker->createTab(tab);
+    });
 }
 
+QFuture<void> DBManager::navigateTo(int tabId, const QString &url, const QString &title, const QString &path)
+{
+    DBWorker *dbWorker = worker;
+    return write([dbWorker, tabId, url, title, path]() {
+        dbWorker->navigateTo(tabId, url, title, path);
+    });
+}
+
+QFuture<void> DBManager::goForward(int tabId)
+{
+    DBWorker *dbWorker = worker;
+    return write([dbWorker, tabId]() {
+        dbWorker->goForward(tabId);
+    });
+}
+
+QFuture<void> DBManager::goBack(int tabId)
+{
+    DBWorker *dbWorker = worker;
+    return write([dbWorker, tabId]() {
+        dbWorker->goBack(tabId);
+    });
+}
+
+QFuture<void> DBManager::getAllTabs()
+{
+    // Served by the writer, which has the thumbnails of background calls
+    DBWorker *dbWorker = worker;
+    return write([dbWorker]() {
+        dbWorker->getAllTabs();
+    });
+}
+
+QFuture<void> DBManager::removeTab(int tabId)
+{
+    DBWorker *dbWorker = worker;
+    return write([dbWorker, tabId]() {
+        dbWorker->removeTab(tabId);
+    });
+}
+
+QFuture<void> DBManager::removeAllTabs()
+{
+    DBWorker *dbWorker = worker;
+    return write([dbWorker]() {
+        dbWorker->removeAllTabs(true);
+    });
+}
+
+// Written once the preceding writes have been committed, so the session
+// snapshot never gets ahead of the database
+QFuture<void> DBManager::saveSession(const QList<Tab> &tabs, int activeTabId)
+{
+    DBWorker *dbWorker = worker;
+    return write([dbWorker, tabs, activeTabId]() {
+        dbWorker->saveSession(tabs, activeTabId);
+    });
+}
+
+QFuture<void> DBManager::updateTitle(int tabId, const QString &url, const QString &title)
+{
+    DBWorker *dbWorker = worker;
+    return background([dbWorker, tabId, url, title]() {
+        dbWorker->updateTitle(tabId, url, title);
+    });
+}
+
+QFuture<void> DBManager::updateThumbPath(int tabId, const QString &path)
+{
+    DBWorker *dbWorker = worker;
+    return background([dbWorker, tabId, path]() {
+        dbWorker->updateThumbPath(tabId, path);
+    });
+}
+
+QFuture<void> DBManager::removeHistoryEntry(int linkId)
+{
+    DBWorker *dbWorker = worker;
+    return write([dbWorker, linkId]() {
+        dbWorker->removeHistoryEntry(linkId);
+    });
+}
+
+QFuture<void> DBManager::clearHistory()
+{
+    DBWorker *dbWorker = worker;
+    return write([dbWorker]() {
+        dbWorker->clearHistory();
+    });
+}
+
+QFuture<void> DBManager::setHistoryLimits(int maxEntries, qint64 maxBytes)
+{
+    DBWorker *dbWorker = worker;
+    return background([dbWorker, maxEntries, maxBytes]() {
+        dbWorker->setHistoryLimits(maxEntries, maxBytes);
+    });
+}
+
+// Searches supersede each other, only the result of the latest one is
+// delivered. A search refining a cached one is answered without a query.
+QFuture<void> DBManager::getHistory(const QString &filter)
+{
+    const int generation = m_searchGeneration.fetchAndAddOrdered(1) + 1;
+    ++m_searchRequests;
+    m_searchTimer.start();
+
+    DBWorker *dbReader = reader;
+    return read([dbReader, filter, generation]() {
+        dbReader->getHistory(filter, generation);
+    });
+}
+
+// Time from the latest search request to its result, in milliseconds
+void DBManager::searchDone()
+{
+    m_lastSearchLatency = m_searchTimer.elapsed();
+    m_maxSearchLatency = qMax(m_maxSearchLatency, m_lastSearchLatency);
+    m_totalSearchLatency += m_lastSearchLatency;
+    ++m_completedSearches;
+#if DEBUG_LOGS
+    qDebug() << "search results after" << m_lastSearchLatency << "ms";
+#endif
+}
+
+// Latencies are in milliseconds from the last request of a burst of searches
+QVariantMap DBManager::searchStatistics() const
+{
+    QVariantMap stats;
+    stats.insert(QStringLiteral("requests"), m_searchRequests);
+    stats.insert(QStringLiteral("completed"), m_completedSearches);
+    stats.insert(QStringLiteral("lastLatency"), m_lastSearchLatency);
+    stats.insert(QStringLiteral("maxLatency"), m_maxSearchLatency);
+    stats.insert(QStringLiteral("averageLatency"),
+                 m_completedSearches > 0 ? m_totalSearchLatency / m_completedSearches : 0);
+    stats.insert(QStringLiteral("cache"), m_searchCache.statistics());
+    return stats;
+}
+
+QFuture<void> DBManager::getMoreHistory(const QString &filter, int afterLinkId, double afterSortKey)
+{
+    DBWorker *dbReader = reader;
+    return read([dbReader, filter, afterLinkId, afterSortKey]() {
+        dbReader->getMoreHistory(filter, afterLinkId, afterSortKey);
+    });
+}
+
+int DBManager::historyPageSize()
+{
+    return HISTORY_PAGE_SIZE;
+}
+
+QFuture<void> DBManager::getTabHistory(int tabId)
+{
+    // Served from the tab histories kept in memory by the writer
+    DBWorker *dbWorker = worker;
+    return write([dbWorker, tabId]() {
+        dbWorker->getTabHistory(tabId);
+    });
+}
+
+// Updates the settings snapshot right away. Changes to the same setting
+// within the write delay are stored once, see flushSettings().
 void DBManager::saveSetting(const QString &name, const QString &value)
 {
+    if (!m_loaded) {
+        m_changedSettings.insert(name);
+    }
     m_settings.insert(name, value);
+    // Null marks a deletion in the pending changes
+    m_pendingSettings.insert(name, value.isNull() ? QStringLiteral("") : value);
+    if (!m_settingsTimer.isActive()) {
+        m_settingsTimer.start();
+    }
     emit settingsChanged();
-    QMetaObject::invokeMethod(worker, "saveSetting", Qt::BlockingQueuedConnection,
-                              Q_ARG(QString, name), Q_ARG(QString, value));
 }
 
 QString DBManager::getSetting(const QString &name)
@@ -161,10 +550,34 @@ QString DBManager::getSetting(const QString &name)
 
 void DBManager::deleteSetting(const QString &name)
 {
-    if (m_settings.contains(name)) {
-        m_settings.remove(name);
-        emit settingsChanged();
-        QMetaObject::invokeMethod(worker, "deleteSetting", Qt::BlockingQueuedConnection,
-                                  Q_ARG(QString, name));
+    if (m_loaded && !m_settings.contains(name)) {
+        return;
+    }
+
+    if (!m_loaded) {
+        m_changedSettings.insert(name);
+    }
+    m_settings.remove(name);
+    m_pendingSettings.insert(name, QString());
+    if (!m_settingsTimer.isActive()) {
+        m_settingsTimer.start();
     }
+    emit settingsChanged();
+}
+
+// Hands the pending setting changes to the worker, the future finishes once
+// they have been executed.
+QFuture<void> DBManager::flushSettings()
+{
+    m_settingsTimer.stop();
+    if (m_pendingSettings.isEmpty()) {
+        return QFuture<void>();
+    }
+
+    SettingsMap settings = m_pendingSettings;
+    m_pendingSettings.clear();
+    DBWorker *dbWorker = worker;
+    return background([dbWorker, settings]() {
+        dbWorker->saveSettings(settings);
+    });
 }
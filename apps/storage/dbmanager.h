@@ -13,14 +13,42 @@
 #define DBMANAGER_H
 
 #include <QObject>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QFuture>
+#include <QFutureWatcher>
 #include <QMap>
+#include <QQueue>
+#include <QSet>
 #include <QThread>
+#include <QTimer>
+#include <QVariantMap>
+#include <functional>
 
 #include "link.h"
+#include "searchcache.h"
+#include "statementprofiler.h"
 #include "tab.h"
+#include "writebarrier.h"
 
 class DBWorker;
 
+/**
+ * Asynchronous interface to the browser database.
+ *
+ * Calls never block the caller and return a QFuture which finishes once the
+ * call has been executed. Queries also deliver their results through the
+ * signals below, in call order.
+ *
+ * Writes run on a writer thread in call order. History searches run on a
+ * reader thread and see every user-visible write made before them. Updates
+ * of titles, thumbnails and settings, statistics and backups are background
+ * work, run at a lower priority once nothing else is queued.
+ *
+ * The database is opened in the background, calls made meanwhile run once it
+ * is open. getSetting() serves a snapshot of the settings, available after
+ * loaded() has been emitted.
+ */
 class DBManager : public QObject
 {
     Q_OBJECT
@@ -28,43 +56,108 @@ public:
     static DBManager *instance();
     virtual ~DBManager();
 
-    void createTab(const Tab &tab);
-    void getAllTabs();
-    void removeTab(int tabId);
-    void removeAllTabs();
-    void navigateTo(int tabId, const QString &url, const QString &title = QString(), const QString &path = QString());
-    void goForward(int tabId);
-    void goBack(int tabId);
-
-    void updateThumbPath(int tabId, const QString &path);
-    void updateTitle(int tabId, const QString &url, const QString &title);
-
-    void removeHistoryEntry(int linkId);
-    void clearHistory();
-    void getHistory(const QString &filter = "");
-    void getTabHistory(int tabId);
+    QFuture<void> createTab(const Tab &tab);
+    QFuture<void> getAllTabs();
+    QFuture<void> removeTab(int tabId);
+    QFuture<void> removeAllTabs();
+    QFuture<void> saveSession(const QList<Tab> &tabs, int activeTabId);
+    QFuture<void> navigateTo(int tabId, const QString &url, const QString &title = QString(), const QString &path = QString());
+    QFuture<void> goForward(int tabId);
+    QFuture<void> goBack(int tabId);
+
+    QFuture<void> updateThumbPath(int tabId, const QString &path);
+    QFuture<void> updateTitle(int tabId, const QString &url, const QString &title);
+
+    QFuture<void> removeHistoryEntry(int linkId);
+    QFuture<void> clearHistory();
+    QFuture<void> setHistoryLimits(int maxEntries, qint64 maxBytes);
+    QFuture<void> getHistory(const QString &filter = "");
+    QFuture<void> getMoreHistory(const QString &filter, int afterLinkId, double afterSortKey);
+    static int historyPageSize();
+    QFuture<void> getTabHistory(int tabId);
 
     void saveSetting(const QString &name, const QString &value);
     QString getSetting(const QString &name);
     void deleteSetting(const QString &name);
+    QFuture<void> flushSettings();
+
+    QFuture<int> getMaxTabId();
 
-    int getMaxTabId();
+    QFuture<void> getStatistics();
+    QFuture<void> backup(const QString &path);
+    void setMaintenanceAllowed(bool allowed);
+    void setStatementProfiling(bool enabled, int slowQueryThreshold);
+    QVariantMap statementProfile() const;
+    QVariantMap searchStatistics() const;
+
+    bool isLoaded() const;
 
 signals:
     void tabsAvailable(QList<Tab> tab);
     void historyAvailable(QList<Link> links);
+    void moreHistoryAvailable(const QString &filter, int afterLinkId, QList<Link> links);
     void tabHistoryAvailable(int tabId, QList<Link> links, int currentLinkId);
     void thumbPathChanged(int tabId, const QString &path);
     void titleChanged(const QString &url, const QString &title);
     void settingsChanged();
+    void statisticsAvailable(const QVariantMap &statistics);
+    void backupFinished(const QString &path, bool ok);
+    void loaded();
+
+private slots:
+    void settingsLoaded();
+    void finishWrites();
+    void writeDone();
+    void readDone();
 
 private:
     DBManager(QObject *parent = 0);
 
+    QFuture<void> write(const std::function<void()> &function);
+    template <typename T> QFuture<T> write(const std::function<T()> &function);
+    QFuture<void> background(const std::function<void()> &function);
+    QFuture<void> read(const std::function<void()> &function);
+    void connectWorker(DBWorker *dbWorker, const QQueue<quint64> *tickets);
+    void deliver(const QQueue<quint64> *tickets, const std::function<void()> &result);
+    void searchDone();
+    void releaseResults();
+
     QMap<QString, QString> m_settings;
+    // Settings written before the snapshot was loaded
+    QSet<QString> m_changedSettings;
+    QFutureWatcher<QMap<QString, QString> > m_loadWatcher;
+    bool m_loaded;
+    // Changes not yet handed to the worker, a null value deletes the setting
+    QMap<QString, QString> m_pendingSettings;
+    QTimer m_settingsTimer;
 
     QThread workerThread;
     DBWorker *worker;
+    QThread readerThread;
+    DBWorker *reader;
+    WriteBarrier m_writeBarrier;
+    // Shared by the writer and the reader
+    StatementProfiler m_profiler;
+
+    // Generation of the latest getHistory() call, read by the reader
+    QAtomicInt m_searchGeneration;
+    // Used by the reader only
+    SearchCache m_searchCache;
+    // Started by the latest getHistory() call
+    QElapsedTimer m_searchTimer;
+    int m_searchRequests;
+    int m_completedSearches;
+    qint64 m_lastSearchLatency;
+    qint64 m_maxSearchLatency;
+    qint64 m_totalSearchLatency;
+
+    // Every call gets a ticket, signals are held back until the results
+    // of all earlier calls have been emitted.
+    quint64 m_lastTicket;
+    quint64 m_lastWriteTicket;
+    QQueue<quint64> m_writerTickets;
+    QQueue<quint64> m_readerTickets;
+    QMap<quint64, QList<std::function<void()> > > m_results;
 };
 
 #endif // DBMANAGER_H
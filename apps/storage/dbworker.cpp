@@ -19,20 +19,104 @@
 #include <QDir>
 #include <QFile>
 #include <QDateTime>
+#include <QElapsedTimer>
+#include <QCoreApplication>
+#include <QMutexLocker>
+#include <QRegularExpression>
+#include <QStringList>
+#include <QThread>
+#include <QVersionNumber>
+#include <QtMath>
+
+#include <sqlite3.h>
+
+#ifdef Q_OS_LINUX
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 #include "dbworker.h"
 #include "browserpaths.h"
+#include "searchcache.h"
+#include "sessionsnapshot.h"
+#include "statementprofiler.h"
+#include "writebarrier.h"
 
 #ifndef DEBUG_LOGS
 #define DEBUG_LOGS 0
 #endif
 
+// Schema version of newly created databases. Newer versions are reached
+// through the migration steps in DBWorker::migrate().
 #define DB_USER_VERSION 1
 
 #define QUOTE(arg) #arg
 #define STR(arg) QUOTE(arg)
 
-#define MAX_BROWSER_HISTORY_SIZE 2000
+// Idle time after the last new history entry before expiring old ones, and
+// the pause between expiry batches, in milliseconds
+#define HISTORY_EXPIRY_DELAY 10000
+#define HISTORY_EXPIRY_INTERVAL 50
+// Number of history entries removed at a time
+#define HISTORY_EXPIRY_BATCH_SIZE 100
+// Estimated bytes of a history entry besides its text, and of a visit, when
+// SQLite cannot tell the pages taken, see DBWorker::historyBytes()
+#define HISTORY_ROW_OVERHEAD 64
+#define VISIT_ROW_SIZE 32
+
+// Idle time after startup before collecting orphaned links, and the pause
+// between batches, in milliseconds
+#define LINK_COLLECTION_DELAY 15000
+#define LINK_COLLECTION_INTERVAL 50
+// Number of orphaned links removed at a time
+#define LINK_COLLECTION_BATCH_SIZE 500
+
+// Visits lose half of their weight in frecency every 30 days. Scores are
+// relative to 2020-01-01 UTC.
+#define FRECENCY_HALF_LIFE (30 * 24 * 60 * 60)
+#define FRECENCY_EPOCH 1577836800
+
+// Page cache of 2 MiB (negative value is in KiB) and 8 MiB of memory mapped I/O
+#define DB_CACHE_SIZE -2048
+#define DB_MMAP_SIZE 8388608
+
+// Safety net for the WAL size in pages, normally checkpoints happen when idle
+#define WAL_AUTOCHECKPOINT 4000
+// Idle time after the last commit before checkpointing the WAL, in milliseconds
+#define WAL_IDLE_CHECKPOINT_DELAY 5000
+
+// Maintenance runs in slices of at most 50 ms with 200 ms breaks in between,
+// and at most once a day
+#define MAINTENANCE_SLICE_BUDGET 50
+#define MAINTENANCE_SLICE_INTERVAL 200
+#define MAINTENANCE_INTERVAL (24 * 60 * 60 * 1000)
+// Rows sampled per index by ANALYZE
+#define ANALYSIS_LIMIT 400
+// Free pages released by a single incremental vacuum step
+#define INCREMENTAL_VACUUM_PAGES 64
+// Largest database converted to incremental vacuum at startup, in bytes
+#define INCREMENTAL_VACUUM_CONVERSION_LIMIT (2 * 1024 * 1024)
+
+// Online backups copy 64 pages at a time with 20 ms breaks in between, so
+// that the calls queued meanwhile are not held up
+#define BACKUP_STEP_PAGES 64
+#define BACKUP_STEP_INTERVAL 20
+
+// How long the reader waits for a lock held by the writer, in milliseconds.
+// Only needed when the database is not in WAL mode.
+#define READER_BUSY_TIMEOUT 5000
+
+// Number of SQLite virtual machine instructions between the checks whether
+// a running search has been superseded
+#define SEARCH_PROGRESS_STEPS 1000
+
+#if defined(Q_OS_LINUX) && defined(SYS_ioprio_set)
+// From linux/ioprio.h, the lowest level of the best effort class
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_SHIFT 13
+#define BACKGROUND_IO_PRIORITY ((IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | 7)
+#endif
 
 static const char * const create_table_tab =
         "CREATE TABLE tab (tab_id INTEGER PRIMARY KEY,\n"
@@ -80,114 +164,1498 @@ static const char *db_schema[] = {
 };
 static int db_schema_count = sizeof(db_schema) / sizeof(*db_schema);
 
+static const char *db_indices[] = {
+    "CREATE INDEX IF NOT EXISTS tab_history_tab_id ON tab_history (tab_id, id);",
+    "CREATE INDEX IF NOT EXISTS tab_history_link_id ON tab_history (link_id);",
+    "CREATE INDEX IF NOT EXISTS browser_history_date ON browser_history (date);",
+    "CREATE INDEX IF NOT EXISTS link_url ON link (url);"
+};
+static int db_indices_count = sizeof(db_indices) / sizeof(*db_indices);
+
+// Full text index over history urls and titles. The index refers to browser_history
+// rows (external content) and triggers keep it in sync.
+static const char *db_history_fts5[] = {
+    "CREATE VIRTUAL TABLE browser_history_fts USING fts5(url, title, "
+    "content='browser_history', content_rowid='id');",
+    "CREATE TRIGGER browser_history_fts_insert AFTER INSERT ON browser_history BEGIN "
+    "INSERT INTO browser_history_fts (rowid, url, title) VALUES (new.id, new.url, new.title); "
+    "END;",
+    "CREATE TRIGGER browser_history_fts_delete AFTER DELETE ON browser_history BEGIN "
+    "INSERT INTO browser_history_fts (browser_history_fts, rowid, url, title) VALUES ('delete', old.id, old.url, old.title); "
+    "END;",
+    "CREATE TRIGGER browser_history_fts_update AFTER UPDATE OF url, title ON browser_history BEGIN "
+    "INSERT INTO browser_history_fts (browser_history_fts, rowid, url, title) VALUES ('delete', old.id, old.url, old.title); "
+    "INSERT INTO browser_history_fts (rowid, url, title) VALUES (new.id, new.url, new.title); "
+    "END;",
+    "INSERT INTO browser_history_fts (browser_history_fts) VALUES ('rebuild');"
+};
+static int db_history_fts5_count = sizeof(db_history_fts5) / sizeof(*db_history_fts5);
+
+// Fallback for SQLite builds without FTS5
+static const char *db_history_fts4[] = {
+    "CREATE VIRTUAL TABLE browser_history_fts USING fts4(content='browser_history', url, title);",
+    "CREATE TRIGGER browser_history_fts_before_delete BEFORE DELETE ON browser_history BEGIN "
+    "DELETE FROM browser_history_fts WHERE docid = old.id; "
+    "END;",
+    "CREATE TRIGGER browser_history_fts_before_update BEFORE UPDATE OF url, title ON browser_history BEGIN "
+    "DELETE FROM browser_history_fts WHERE docid = old.id; "
+    "END;",
+    "CREATE TRIGGER browser_history_fts_insert AFTER INSERT ON browser_history BEGIN "
+    "INSERT INTO browser_history_fts (docid, url, title) VALUES (new.id, new.url, new.title); "
+    "END;",
+    "CREATE TRIGGER browser_history_fts_update AFTER UPDATE OF url, title ON browser_history BEGIN "
+    "INSERT INTO browser_history_fts (docid, url, title) VALUES (new.id, new.url, new.title); "
+    "END;",
+    "INSERT INTO browser_history_fts (browser_history_fts) VALUES ('rebuild');"
+};
+static int db_history_fts4_count = sizeof(db_history_fts4) / sizeof(*db_history_fts4);
+
+static const char *db_visits[] = {
+    "CREATE TABLE visits (id INTEGER PRIMARY KEY AUTOINCREMENT,\n"
+    "history_id INTEGER,\n"
+    "date INTEGER,\n"
+    "transition INTEGER\n"
+    ");",
+    "CREATE INDEX visits_history_id ON visits (history_id);",
+    "CREATE TRIGGER browser_history_visits_delete AFTER DELETE ON browser_history BEGIN "
+    "DELETE FROM visits WHERE history_id = old.id; "
+    "END;",
+    "ALTER TABLE browser_history ADD COLUMN frecency REAL DEFAULT 0;",
+    "CREATE INDEX browser_history_frecency ON browser_history (frecency);"
+};
+static int db_visits_count = sizeof(db_visits) / sizeof(*db_visits);
+
+// Stores every url once. link and browser_history refer to it by id, and the
+// triggers count the references. Rows that are no longer referenced are
+// removed by DBWorker::releaseUrls().
+static const char *db_url_dictionary[] = {
+    "CREATE TABLE url (id INTEGER PRIMARY KEY,\n"
+    "url TEXT UNIQUE NOT NULL,\n"
+    "refcount INTEGER NOT NULL DEFAULT 0\n"
+    ");",
+    "INSERT OR IGNORE INTO url (url) SELECT url FROM link WHERE url IS NOT NULL;",
+    "INSERT OR IGNORE INTO url (url) SELECT url FROM browser_history WHERE url IS NOT NULL;",
+    "CREATE TABLE link_interned (link_id INTEGER PRIMARY KEY AUTOINCREMENT,\n"
+    "url_id INTEGER,\n"
+    "title TEXT,\n"
+    "thumb_path TEXT\n"
+    ");",
+    "INSERT INTO link_interned (link_id, url_id, title, thumb_path) "
+    "SELECT link_id, (SELECT url.id FROM url WHERE url.url = link.url), title, thumb_path FROM link;",
+    "DROP TABLE link;",
+    "ALTER TABLE link_interned RENAME TO link;",
+    "CREATE TABLE browser_history_interned (id INTEGER PRIMARY KEY AUTOINCREMENT,\n"
+    "url_id INTEGER UNIQUE,\n"
+    "title TEXT,\n"
+    "favorite_icon TEXT,\n"
+    "visited_count INTEGER DEFAULT 1,\n"
+    "date INTEGER,\n"
+    "frecency REAL DEFAULT 0\n"
+    ");",
+    "INSERT INTO browser_history_interned (id, url_id, title, favorite_icon, visited_count, date, frecency) "
+    "SELECT id, (SELECT url.id FROM url WHERE url.url = browser_history.url), title, favorite_icon, visited_count, date, frecency "
+    "FROM browser_history;",
+    // Also drops the indices and triggers of the old tables
+    "DROP TABLE browser_history;",
+    "ALTER TABLE browser_history_interned RENAME TO browser_history;",
+    "CREATE INDEX link_url_id ON link (url_id);",
+    "CREATE INDEX browser_history_date ON browser_history (date);",
+    "CREATE INDEX browser_history_frecency ON browser_history (frecency);",
+    "CREATE TRIGGER browser_history_visits_delete AFTER DELETE ON browser_history BEGIN "
+    "DELETE FROM visits WHERE history_id = old.id; "
+    "END;",
+    "CREATE TRIGGER link_url_ref AFTER INSERT ON link BEGIN "
+    "UPDATE url SET refcount = refcount + 1 WHERE id = new.url_id; "
+    "END;",
+    "CREATE TRIGGER link_url_unref AFTER DELETE ON link BEGIN "
+    "UPDATE url SET refcount = refcount - 1 WHERE id = old.url_id; "
+    "END;",
+    "CREATE TRIGGER browser_history_url_ref AFTER INSERT ON browser_history BEGIN "
+    "UPDATE url SET refcount = refcount + 1 WHERE id = new.url_id; "
+    "END;",
+    "CREATE TRIGGER browser_history_url_unref AFTER DELETE ON browser_history BEGIN "
+    "UPDATE url SET refcount = refcount - 1 WHERE id = old.url_id; "
+    "END;",
+    "UPDATE url SET refcount = (SELECT COUNT(*) FROM link WHERE link.url_id = url.id) "
+    "+ (SELECT COUNT(*) FROM browser_history WHERE browser_history.url_id = url.id);",
+    "CREATE INDEX url_unreferenced ON url (id) WHERE refcount <= 0;",
+    // Text of history entries for the full text index
+    "CREATE VIEW browser_history_text AS SELECT browser_history.id AS rowid, url.url AS url, browser_history.title AS title "
+    "FROM browser_history INNER JOIN url ON url.id = browser_history.url_id;"
+};
+static int db_url_dictionary_count = sizeof(db_url_dictionary) / sizeof(*db_url_dictionary);
+
+// Full text index over the interned history, same as db_history_fts5 and
+// db_history_fts4 but urls come from the url table.
+static const char *db_history_text_fts5[] = {
+    "CREATE VIRTUAL TABLE browser_history_fts USING fts5(url, title, content='browser_history_text');",
+    "CREATE TRIGGER browser_history_fts_insert AFTER INSERT ON browser_history BEGIN "
+    "INSERT INTO browser_history_fts (rowid, url, title) "
+    "VALUES (new.id, (SELECT url FROM url WHERE id = new.url_id), new.title); "
+    "END;",
+    "CREATE TRIGGER browser_history_fts_delete AFTER DELETE ON browser_history BEGIN "
+    "INSERT INTO browser_history_fts (browser_history_fts, rowid, url, title) "
+    "VALUES ('delete', old.id, (SELECT url FROM url WHERE id = old.url_id), old.title); "
+    "END;",
+    "CREATE TRIGGER browser_history_fts_update AFTER UPDATE OF url_id, title ON browser_history BEGIN "
+    "INSERT INTO browser_history_fts (browser_history_fts, rowid, url, title) "
+    "VALUES ('delete', old.id, (SELECT url FROM url WHERE id = old.url_id), old.title); "
+    "INSERT INTO browser_history_fts (rowid, url, title) "
+    "VALUES (new.id, (SELECT url FROM url WHERE id = new.url_id), new.title); "
+    "END;",
+    "INSERT INTO browser_history_fts (browser_history_fts) VALUES ('rebuild');"
+};
+static int db_history_text_fts5_count = sizeof(db_history_text_fts5) / sizeof(*db_history_text_fts5);
+
+static const char *db_history_text_fts4[] = {
+    "CREATE VIRTUAL TABLE browser_history_fts USING fts4(content='browser_history_text', url, title);",
+    "CREATE TRIGGER browser_history_fts_before_delete BEFORE DELETE ON browser_history BEGIN "
+    "DELETE FROM browser_history_fts WHERE docid = old.id; "
+    "END;",
+    "CREATE TRIGGER browser_history_fts_before_update BEFORE UPDATE OF url_id, title ON browser_history BEGIN "
+    "DELETE FROM browser_history_fts WHERE docid = old.id; "
+    "END;",
+    "CREATE TRIGGER browser_history_fts_insert AFTER INSERT ON browser_history BEGIN "
+    "INSERT INTO browser_history_fts (docid, url, title) "
+    "VALUES (new.id, (SELECT url FROM url WHERE id = new.url_id), new.title); "
+    "END;",
+    "CREATE TRIGGER browser_history_fts_update AFTER UPDATE OF url_id, title ON browser_history BEGIN "
+    "INSERT INTO browser_history_fts (docid, url, title) "
+    "VALUES (new.id, (SELECT url FROM url WHERE id = new.url_id), new.title); "
+    "END;",
+    "INSERT INTO browser_history_fts (browser_history_fts) VALUES ('rebuild');"
+};
+static int db_history_text_fts4_count = sizeof(db_history_text_fts4) / sizeof(*db_history_text_fts4);
+
+// Frecency contribution of a single visit. Instead of decaying old visits, each
+// visit is weighted up exponentially by its time. Scaling every score by the same
+// factor does not change their order, so stored sums never need recomputing and
+// a new visit is simply added to the score.
+static double visitScore(qint64 visitTime, VisitTransition transition)
+{
+    // New tabs are mostly opened for typed urls and bookmarks
+    double weight = transition == VisitNewTab ? 1.5 : 1.0;
+    return weight * qPow(2.0, double(visitTime - FRECENCY_EPOCH) / FRECENCY_HALF_LIFE);
+}
+
+// Turns user input into a full text query where every word is matched as a prefix,
+// e.g. "sailfish bro" becomes "sailfish* bro*". Words are split the same way as the
+// default tokenizer splits them and lower cased so that they are never taken as
+// query operators.
+static QString fullTextQuery(const QString &filter)
+{
+    static const QRegularExpression separator(QStringLiteral("[^\\p{L}\\p{N}]+"));
+    QStringList terms;
+    foreach (const QString &word, filter.toLower().split(separator, QString::SkipEmptyParts)) {
+        terms << word + QLatin1Char('*');
+    }
+    return terms.join(QLatin1Char(' '));
+}
+
+static const char * const db_tuning[] = {
+    "PRAGMA cache_size = " STR(DB_CACHE_SIZE) ";",
+    "PRAGMA mmap_size = " STR(DB_MMAP_SIZE) ";",
+    "PRAGMA temp_store = MEMORY;"
+};
+static int db_tuning_count = sizeof(db_tuning) / sizeof(*db_tuning);
+
+DBTask::DBTask(const std::function<void()> &function, TaskPriority priority, quint64 sequence)
+    : QEvent(eventType())
+    , m_function(function)
+    , m_priority(priority)
+    , m_sequence(sequence)
+{
+}
+
+void DBTask::run()
+{
+    m_function();
+}
+
+TaskPriority DBTask::priority() const
+{
+    return m_priority;
+}
+
+quint64 DBTask::sequence() const
+{
+    return m_sequence;
+}
+
+QEvent::Type DBTask::eventType()
+{
+    static int type = QEvent::registerEventType();
+    return static_cast<QEvent::Type>(type);
+}
+
+// Posted for each background task, the worker then runs the oldest one
+QEvent::Type DBTask::backgroundEventType()
+{
+    static int type = QEvent::registerEventType();
+    return static_cast<QEvent::Type>(type);
+}
+
+// Lowers the priority of the calling thread while it runs background work.
+// On Linux the I/O priority is lowered: an unprivileged thread could not get
+// its nice value back, and Qt thread priorities do not apply to the default
+// scheduling policy.
+class BackgroundScope
+{
+public:
+    BackgroundScope()
+    {
+#ifdef BACKGROUND_IO_PRIORITY
+        m_priority = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, 0);
+        if (m_priority >= 0) {
+            syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, BACKGROUND_IO_PRIORITY);
+        }
+#else
+        m_priority = QThread::currentThread()->priority();
+        QThread::currentThread()->setPriority(QThread::LowPriority);
+#endif
+    }
+
+    ~BackgroundScope()
+    {
+#ifdef BACKGROUND_IO_PRIORITY
+        if (m_priority >= 0) {
+            syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, m_priority);
+        }
+#else
+        QThread::currentThread()->setPriority(m_priority == QThread::InheritPriority
+                                              ? QThread::NormalPriority
+                                              : static_cast<QThread::Priority>(m_priority));
+#endif
+    }
+
+private:
+    int m_priority;
+};
+
 DBWorker::DBWorker(QObject *parent) :
-    QObject(parent)
+    QObject(parent),
+    m_batcher(this),
+    m_writeBarrier(0),
+    m_profiler(0),
+    m_searchGeneration(0),
+    m_runningSearch(0),
+    m_searchCache(0),
+    m_writeSequence(0),
+    m_pendingTasks(0),
+    m_runningSequence(0),
+    m_foregroundTaskCount(0),
+    m_backgroundTaskCount(0),
+    m_promotedTaskCount(0),
+    m_deferredWorkCount(0),
+    m_maxBackgroundQueue(0),
+    m_backgroundTime(0),
+    m_checkpointTimer(this),
+    m_expiryTimer(this),
+    m_historyMaxEntries(DEFAULT_HISTORY_MAX_ENTRIES),
+    m_historyMaxBytes(DEFAULT_HISTORY_MAX_BYTES),
+    m_dbstatSupported(false),
+    m_expiredEntries(0),
+    m_expiryBatches(0),
+    m_linkCollectionTimer(this),
+    m_collectedLinks(0),
+    m_maintenanceTimer(this),
+    m_maintenanceAllowed(0),
+    m_maintenanceStep(MaintenanceDone),
+    m_maintenanceRuns(0),
+    m_maintenanceTime(0),
+    m_reclaimedBytes(0),
+    m_backupDatabase(0),
+    m_backup(0),
+    m_backupTimer(this),
+    m_backupCount(0),
+    m_failedBackups(0),
+    m_walEnabled(false),
+    m_checkpointCount(0),
+    m_checkpointedPages(0),
+    m_fullTextSearch(NoFullTextSearch),
+    m_upsertSupported(false),
+    m_sqliteLinked(false),
+    m_statementCacheEnabled(true),
+    m_statementCacheHits(0),
+    m_statementCacheMisses(0)
 {
+    m_checkpointTimer.setSingleShot(true);
+    m_checkpointTimer.setInterval(WAL_IDLE_CHECKPOINT_DELAY);
+    connect(&m_checkpointTimer, &QTimer::timeout, this, &DBWorker::checkpoint);
+    m_expiryTimer.setSingleShot(true);
+    m_expiryTimer.setInterval(HISTORY_EXPIRY_DELAY);
+    connect(&m_expiryTimer, &QTimer::timeout, this, &DBWorker::expireHistory);
+    m_linkCollectionTimer.setSingleShot(true);
+    connect(&m_linkCollectionTimer, &QTimer::timeout, this, &DBWorker::collectLinks);
+    m_maintenanceTimer.setSingleShot(true);
+    m_maintenanceTimer.setInterval(MAINTENANCE_SLICE_INTERVAL);
+    connect(&m_maintenanceTimer, &QTimer::timeout, this, &DBWorker::maintain);
+    m_backupTimer.setSingleShot(true);
+    m_backupTimer.setInterval(BACKUP_STEP_INTERVAL);
+    connect(&m_backupTimer, &QTimer::timeout, this, &DBWorker::backupStep);
+    connect(&m_batcher, &TransactionBatcher::committed, this, &DBWorker::publishWrites);
+    connect(&m_batcher, &TransactionBatcher::rolledBack, this, &DBWorker::publishWrites);
 }
 
-void DBWorker::init()
+DBWorker::~DBWorker()
+{
+    if (m_backup) {
+        finishBackup(false);
+    }
+    m_batcher.flush();
+    clearStatementCache();
+    qDeleteAll(m_backgroundTasks);
+}
+
+void DBWorker::setStatementCacheEnabled(bool enabled)
+{
+    m_statementCacheEnabled = enabled;
+    if (!enabled) {
+        clearStatementCache();
+    }
+}
+
+// Limits for the number of history entries and for the size of the database
+// in bytes. Zero or less disables a limit. Older entries are expired once the
+// worker is idle.
+void DBWorker::setHistoryLimits(int maxEntries, qint64 maxBytes)
+{
+    m_historyMaxEntries = maxEntries;
+    m_historyMaxBytes = maxBytes;
+    if (m_database.isOpen()) {
+        m_expiryTimer.start(HISTORY_EXPIRY_DELAY);
+    }
+}
+
+// Queues task for the thread of the worker, can be called from any thread.
+// User-visible tasks run in call order, background tasks once nothing else
+// is queued.
+void DBWorker::post(DBTask *task)
+{
+    if (task->priority() == BackgroundPriority) {
+        {
+            QMutexLocker locker(&m_backgroundMutex);
+            m_backgroundTasks.enqueue(task);
+            m_maxBackgroundQueue = qMax(m_maxBackgroundQueue, m_backgroundTasks.count());
+        }
+        QCoreApplication::postEvent(this, new QEvent(DBTask::backgroundEventType()), Qt::LowEventPriority);
+        return;
+    }
+
+    m_pendingTasks.ref();
+    QCoreApplication::postEvent(this, task);
+}
+
+bool DBWorker::event(QEvent *event)
+{
+    if (event->type() == DBTask::eventType()) {
+        DBTask *task = static_cast<DBTask *>(event);
+        m_runningSequence = task->sequence();
+        task->run();
+        m_runningSequence = 0;
+        ++m_foregroundTaskCount;
+        m_pendingTasks.deref();
+        return true;
+    }
+
+    if (event->type() == DBTask::backgroundEventType()) {
+        // Gone already if a later call needed it
+        DBTask *task = takeBackgroundTask(0);
+        if (task) {
+            QElapsedTimer timer;
+            timer.start();
+            {
+                BackgroundScope scope;
+                task->run();
+            }
+            m_backgroundTime += timer.elapsed();
+            ++m_backgroundTaskCount;
+            delete task;
+        }
+        return true;
+    }
+    return QObject::event(event);
+}
+
+// Takes the oldest background task, if before is set only one posted before it
+DBTask *DBWorker::takeBackgroundTask(quint64 before)
+{
+    QMutexLocker locker(&m_backgroundMutex);
+    if (m_backgroundTasks.isEmpty() || (before > 0 && m_backgroundTasks.head()->sequence() >= before)) {
+        return 0;
+    }
+    return m_backgroundTasks.dequeue();
+}
+
+// Runs the background tasks posted before the running task, or all of them
+// outside of tasks. Called by the calls reading what background tasks write,
+// these then run at the priority of the caller.
+void DBWorker::runBackgroundTasks()
+{
+    while (DBTask *task = takeBackgroundTask(m_runningSequence)) {
+        task->run();
+        ++m_promotedTaskCount;
+        delete task;
+    }
+}
+
+// Background work run by timers gives way to queued tasks, returns true if
+// it has been postponed by interval milliseconds.
+bool DBWorker::deferBackgroundWork(QTimer *timer, int interval)
+{
+    if (m_pendingTasks.load() == 0) {
+        return false;
+    }
+    ++m_deferredWorkCount;
+    timer->start(interval);
+    return true;
+}
+
+void DBWorker::setWriteBarrier(WriteBarrier *barrier)
+{
+    m_writeBarrier = barrier;
+}
+
+void DBWorker::setStatementProfiler(StatementProfiler *profiler)
+{
+    m_profiler = profiler;
+}
+
+// Searches made with getHistory() are dropped once generation has moved past
+// theirs. The counter is shared with the thread requesting the searches.
+void DBWorker::setSearchGeneration(const QAtomicInt *generation)
+{
+    m_searchGeneration = generation;
+}
+
+// First pages of searches are served from cache when possible, used by the reader
+void DBWorker::setSearchCache(SearchCache *cache)
+{
+    m_searchCache = cache;
+}
+
+// Called by the writer after each write. Writes become visible to the reader
+// once their batch is committed, a waiting reader gets it committed right away.
+void DBWorker::finishWrite(quint64 sequence)
+{
+    m_writeSequence = sequence;
+    if (!m_batcher.inTransaction()) {
+        publishWrites();
+    } else if (m_writeBarrier && m_writeBarrier->isAwaited(sequence)) {
+        flush();
+    }
+}
+
+void DBWorker::publishWrites()
+{
+    if (m_writeBarrier) {
+        m_writeBarrier->publish(m_writeSequence);
+    }
+}
+
+// Called by the reader before a query, waits for the writes requested before it.
+void DBWorker::beginRead(quint64 sequence)
+{
+    if (m_writeBarrier) {
+        m_writeBarrier->wait(sequence);
+    }
+
+    if (!m_database.isOpen()) {
+        initReader();
+    }
+}
+
+void DBWorker::endRead()
+{
+    // Release the read snapshot so that checkpoints can complete
+    resetStatementCache();
+}
+
+QString DBWorker::databasePath()
 {
     QString databaseDir = BrowserPaths::dataLocation();
     if (databaseDir.isNull()) {
+        return QString();
+    }
+    return QDir(databaseDir).absoluteFilePath(QLatin1String(DB_NAME));
+}
+
+void DBWorker::init()
+{
+    const QString dbPath = databasePath();
+    if (dbPath.isNull()) {
         return;
     }
-    QDir dir(databaseDir);
-    const QString dbFileName(QLatin1String(DB_NAME));
 
     m_database = QSqlDatabase::addDatabase("QSQLITE");
-    m_database.setDatabaseName(dir.absoluteFilePath(dbFileName));
-    bool dbCreated = dir.exists(dbFileName);
+    m_database.setDatabaseName(dbPath);
+    bool dbCreated = QFile::exists(dbPath);
     bool ok = m_database.open();
 
     if (!ok)
         qWarning() << "Failed to open database " << m_database.databaseName();
 
     if (!dbCreated) {
-        //TODO check transaction & rollback/commit
-        for (int i = 0; i < db_schema_count; ++i) {
+        // Lets maintenance give free pages back to the file system in steps.
+        // Only possible before anything has been written to the file.
+        QSqlQuery autoVacuum = prepare("PRAGMA auto_vacuum = INCREMENTAL;");
+        execute(autoVacuum);
+    }
+
+    configureDatabase();
+
+    // Asked from the connection, Qt may use its own copy of SQLite, see
+    // detectSqliteLibrary()
+    m_upsertSupported = QVersionNumber::fromString(textQuery("SELECT sqlite_version();")) >= QVersionNumber(3, 24);
+    detectSqliteLibrary();
+
+    if (!dbCreated) {
+        m_database.transaction();
+        bool created = true;
+        for (int i = 0; i < db_schema_count && created; ++i) {
             QSqlQuery query = prepare(db_schema[i]);
+            created = execute(query);
+        }
+        if (!created || !m_database.commit()) {
+            qCritical() << "Failed to create database schema";
+            m_database.rollback();
+        }
+    }
+
+    // check current schema version and migrate if needed
+    migrate();
+    enableIncrementalVacuum();
+    detectFullTextSearch();
+    loadTabHistories();
+
+    // Lets the history be measured by pages, see historyBytes(). Probed
+    // without prepare() as SQLite builds without dbstat are expected.
+    QSqlQuery dbstat(m_database);
+    m_dbstatSupported = dbstat.exec("SELECT 1 FROM dbstat LIMIT 1;");
+    dbstat.finish();
+
+    // Schema creation and migration statements are not needed again.
+    clearStatementCache();
+
+    // Writes after this point are grouped into batched transactions.
+    m_batcher.setDatabase(m_database);
+    if (m_walEnabled) {
+        connect(&m_batcher, &TransactionBatcher::committed,
+                &m_checkpointTimer, static_cast<void (QTimer::*)()>(&QTimer::start), Qt::UniqueConnection);
+    }
+
+    // History is trimmed once startup is over, not on the way there.
+    m_expiryTimer.start(HISTORY_EXPIRY_DELAY);
+    m_linkCollectionTimer.start(LINK_COLLECTION_DELAY);
+}
+
+// Opens a read-only connection for queries, used by the reader instance
+// once the writer has created and migrated the database.
+void DBWorker::initReader()
+{
+    const QString dbPath = databasePath();
+    if (dbPath.isNull()) {
+        return;
+    }
+
+    m_database = QSqlDatabase::addDatabase("QSQLITE", QStringLiteral("reader"));
+    m_database.setDatabaseName(dbPath);
+    m_database.setConnectOptions(QStringLiteral("QSQLITE_OPEN_READONLY;QSQLITE_BUSY_TIMEOUT=" STR(READER_BUSY_TIMEOUT)));
+    if (!m_database.open()) {
+        qWarning() << "Failed to open database for reading" << m_database.databaseName();
+        return;
+    }
+
+    for (int i = 0; i < db_tuning_count; ++i) {
+        QSqlQuery query = prepare(db_tuning[i]);
+        execute(query);
+    }
+
+    detectSqliteLibrary();
+    detectFullTextSearch();
+    clearStatementCache();
+}
+
+// Databases created before incremental vacuum are converted by a full VACUUM.
+// It rewrites the whole file and cannot be split into slices or stopped, so it
+// is only done at startup and only while the database is small. Larger ones
+// keep their free pages.
+void DBWorker::enableIncrementalVacuum()
+{
+    if (integerQuery("PRAGMA auto_vacuum;") == 2) {
+        return;
+    }
+
+    qint64 bytes = qint64(integerQuery("PRAGMA page_count;")) * integerQuery("PRAGMA page_size;");
+    if (bytes > INCREMENTAL_VACUUM_CONVERSION_LIMIT) {
+        return;
+    }
+
+    resetStatementCache();
+    QSqlQuery query = prepare("PRAGMA auto_vacuum = INCREMENTAL;");
+    execute(query);
+    query = prepare("VACUUM;");
+    execute(query);
+    query.finish();
+}
+
+// The handle of the Qt driver can only be passed to the SQLite library linked
+// here when the driver runs on the same build. Qt may bundle its own copy,
+// the online backup and interrupting searches are not available then.
+void DBWorker::detectSqliteLibrary()
+{
+    m_sqliteLinked = textQuery("SELECT sqlite_source_id();") == QLatin1String(sqlite3_sourceid());
+    if (!m_sqliteLinked) {
+        qWarning() << "Qt uses SQLite" << textQuery("SELECT sqlite_version();") << "instead of"
+                   << sqlite3_libversion() << "- online backup and search interruption are disabled";
+    }
+}
+
+void DBWorker::detectFullTextSearch()
+{
+    QString ftsSchema = textQuery("SELECT sql FROM sqlite_master WHERE type = 'table' AND name = 'browser_history_fts';");
+    if (ftsSchema.contains(QLatin1String("fts5"), Qt::CaseInsensitive)) {
+        m_fullTextSearch = Fts5;
+    } else if (ftsSchema.contains(QLatin1String("fts4"), Qt::CaseInsensitive)) {
+        m_fullTextSearch = Fts4;
+    } else {
+        m_fullTextSearch = NoFullTextSearch;
+    }
+}
+
+// Switches the database to write-ahead logging and applies cache settings. Falls
+// back to the rollback journal with full syncs if WAL is not available, e.g. when
+// the file system does not support shared memory.
+void DBWorker::configureDatabase()
+{
+    m_walEnabled = textQuery("PRAGMA journal_mode = WAL;").compare(QLatin1String("wal"), Qt::CaseInsensitive) == 0;
+    if (m_walEnabled) {
+        QSqlQuery query = prepare("PRAGMA synchronous = NORMAL;");
+        execute(query);
+        query = prepare("PRAGMA wal_autocheckpoint = " STR(WAL_AUTOCHECKPOINT) ";");
+        execute(query);
+    } else {
+        qWarning() << "Failed to enable WAL journal mode, using rollback journal";
+        QSqlQuery query = prepare("PRAGMA journal_mode = DELETE;");
+        execute(query);
+        query = prepare("PRAGMA synchronous = FULL;");
+        execute(query);
+    }
+
+    for (int i = 0; i < db_tuning_count; ++i) {
+        QSqlQuery query = prepare(db_tuning[i]);
+        execute(query);
+    }
+
+    // Check what SQLite actually accepted
+    int synchronous = integerQuery("PRAGMA synchronous;");
+    int cacheSize = integerQuery("PRAGMA cache_size;");
+    if (synchronous != (m_walEnabled ? 1 : 2) || cacheSize != DB_CACHE_SIZE) {
+        qWarning() << "Unexpected database settings, synchronous:" << synchronous << "cache_size:" << cacheSize;
+    }
+#if DEBUG_LOGS
+    qDebug() << "journal mode:" << textQuery("PRAGMA journal_mode;")
+             << "synchronous:" << synchronous
+             << "cache size:" << cacheSize
+             << "mmap size:" << integerQuery("PRAGMA mmap_size;");
+#endif
+}
+
+// Moves the WAL content back to the database while the worker is idle, so that
+// checkpoints do not hit whichever write happens to cross the autocheckpoint limit.
+void DBWorker::checkpoint()
+{
+    if (!m_walEnabled || m_batcher.inTransaction()) {
+        return;
+    }
+
+    // Cached read statements that have not been reset keep a snapshot open,
+    // which would prevent the checkpoint from completing.
+    resetStatementCache();
+
+    QSqlQuery query = prepare("PRAGMA wal_checkpoint(PASSIVE);");
+    if (execute(query) && query.first()) {
+        ++m_checkpointCount;
+        m_checkpointedPages += query.value(2).toInt();
+#if DEBUG_LOGS
+        qDebug() << "checkpoint busy:" << query.value(0).toInt()
+                 << "wal pages:" << query.value(1).toInt()
+                 << "checkpointed:" << query.value(2).toInt();
+#endif
+    }
+    query.finish();
+}
+
+// Removes one batch of the oldest history entries while the history is over
+// its limits, and schedules the next batch. Small batches keep the worker
+// responsive to the calls queued meanwhile.
+void DBWorker::expireHistory()
+{
+    if (!m_database.isOpen() || deferBackgroundWork(&m_expiryTimer, HISTORY_EXPIRY_INTERVAL)) {
+        return;
+    }
+    BackgroundScope scope;
+
+    int excessEntries = 0;
+    if (m_historyMaxEntries > 0) {
+        excessEntries = qMax(0, integerQuery("SELECT COUNT(*) FROM browser_history;") - m_historyMaxEntries);
+    }
+
+    bool overBudget = false;
+    if (m_historyMaxBytes > 0) {
+        overBudget = historyBytes() > m_historyMaxBytes;
+    }
+
+    if (excessEntries == 0 && !overBudget) {
+        return;
+    }
+
+    int batchSize = excessEntries > 0 ? qMin(excessEntries, HISTORY_EXPIRY_BATCH_SIZE) : HISTORY_EXPIRY_BATCH_SIZE;
+
+    m_batcher.addWrite();
+    QSqlQuery query = prepare("DELETE FROM browser_history WHERE id IN "
+                              "(SELECT id FROM browser_history ORDER BY date ASC, id ASC LIMIT ?);");
+    query.bindValue(0, batchSize);
+    if (!execute(query)) {
+        return;
+    }
+    int expired = query.numRowsAffected();
+    releaseUrls();
+
+    ++m_expiryBatches;
+    m_expiredEntries += expired;
+#if DEBUG_LOGS
+    qDebug() << "expired" << expired << "history entries," << excessEntries << "over the limit";
+#endif
+
+    if (expired > 0) {
+        m_expiryTimer.start(HISTORY_EXPIRY_INTERVAL);
+    }
+}
+
+// Returns the bytes taken by the history: its entries, their visits and the
+// full text index, with their indices. Urls are shared with the tab history,
+// the history is charged for its share of them. Tabs and their navigation
+// history do not count, expiring history would not make them any smaller.
+qint64 DBWorker::historyBytes()
+{
+    qint64 entries = integerQuery("SELECT COUNT(*) FROM browser_history;");
+    if (entries == 0) {
+        return 0;
+    }
+
+    // The full text index keeps deleted entries until its segments are merged,
+    // its pages would lag behind expiry. Counted by the text it indexes.
+    qint64 textBytes = 0;
+    QSqlQuery query = prepare("SELECT SUM(LENGTH(url.url) + IFNULL(LENGTH(browser_history.title), 0)) "
+                              "FROM browser_history INNER JOIN url ON url.id = browser_history.url_id;");
+    if (execute(query) && query.first()) {
+        textBytes = query.value(0).toLongLong();
+    }
+    query.finish();
+    qint64 bytes = m_fullTextSearch != NoFullTextSearch ? textBytes : 0;
+
+    if (m_dbstatSupported) {
+        query = prepare("SELECT SUM(pgsize) FROM dbstat WHERE name IN "
+                        "(SELECT name FROM sqlite_master WHERE tbl_name IN ('browser_history', 'visits'));");
+        if (execute(query) && query.first()) {
+            bytes += query.value(0).toLongLong();
+        }
+        query.finish();
+
+        query = prepare("SELECT SUM(pgsize) FROM dbstat WHERE name IN "
+                        "(SELECT name FROM sqlite_master WHERE tbl_name = 'url');");
+        if (execute(query) && query.first()) {
+            qint64 urls = integerQuery("SELECT COUNT(*) FROM url;");
+            // browser_history.url_id is unique, each entry has a url of its own
+            bytes += urls > 0 ? query.value(0).toLongLong() * qMin(entries, urls) / urls : 0;
+        }
+        query.finish();
+    } else {
+        // Estimated from the row sizes when SQLite cannot tell the pages taken
+        query = prepare("SELECT SUM(IFNULL(LENGTH(favorite_icon), 0)) FROM browser_history;");
+        if (execute(query) && query.first()) {
+            bytes += query.value(0).toLongLong();
+        }
+        query.finish();
+        bytes += textBytes + entries * HISTORY_ROW_OVERHEAD
+                + qint64(integerQuery("SELECT COUNT(*) FROM visits;")) * VISIT_ROW_SIZE;
+    }
+    return bytes;
+}
+
+// Removes one batch of links that no tab history entry refers to, and
+// schedules the next batch. Closed tabs used to leave their links behind.
+void DBWorker::collectLinks()
+{
+    if (!m_database.isOpen() || deferBackgroundWork(&m_linkCollectionTimer, LINK_COLLECTION_INTERVAL)) {
+        return;
+    }
+    BackgroundScope scope;
+
+    // Checked first so that nothing is written when there is nothing to do
+    if (!integerQuery("SELECT EXISTS (SELECT 1 FROM link WHERE NOT EXISTS "
+                      "(SELECT 1 FROM tab_history WHERE tab_history.link_id = link.link_id));")) {
+        return;
+    }
+
+    m_batcher.addWrite();
+    QSqlQuery query = prepare("DELETE FROM link WHERE link_id IN "
+                              "(SELECT link_id FROM link WHERE NOT EXISTS "
+                              "(SELECT 1 FROM tab_history WHERE tab_history.link_id = link.link_id) LIMIT ?);");
+    query.bindValue(0, LINK_COLLECTION_BATCH_SIZE);
+    if (!execute(query)) {
+        return;
+    }
+    int collected = query.numRowsAffected();
+    releaseUrls();
+
+    m_collectedLinks += collected;
+#if DEBUG_LOGS
+    qDebug() << "collected" << collected << "orphaned links";
+#endif
+
+    if (collected == LINK_COLLECTION_BATCH_SIZE) {
+        m_linkCollectionTimer.start(LINK_COLLECTION_INTERVAL);
+    }
+}
+
+// Allows maintenance while the browser is in the background. Can be called from
+// any thread, a running maintenance slice stops at its next step once disallowed.
+void DBWorker::setMaintenanceAllowed(bool allowed)
+{
+    m_maintenanceAllowed.store(allowed ? 1 : 0);
+    if (allowed) {
+        QMetaObject::invokeMethod(this, "maintain", Qt::QueuedConnection);
+    }
+}
+
+// Runs one time slice of maintenance and schedules the next one: statistics
+// for the query planner, compacting the file and truncating the WAL.
+void DBWorker::maintain()
+{
+    if (!m_maintenanceAllowed.load() || !m_database.isOpen()
+            || deferBackgroundWork(&m_maintenanceTimer, MAINTENANCE_SLICE_INTERVAL)) {
+        return;
+    }
+
+    if (m_maintenanceStep == MaintenanceDone) {
+        if (m_lastMaintenance.isValid() && !m_lastMaintenance.hasExpired(MAINTENANCE_INTERVAL)) {
+            return;
+        }
+        m_maintenanceStep = AnalyzeStep;
+    }
+
+    // None of the steps can run inside the write transaction
+    flush();
+    resetStatementCache();
+
+    BackgroundScope scope;
+    QElapsedTimer timer;
+    timer.start();
+    while (m_maintenanceStep != MaintenanceDone && m_maintenanceAllowed.load()
+           && !timer.hasExpired(MAINTENANCE_SLICE_BUDGET)) {
+        if (!runMaintenanceStep(timer)) {
+            m_maintenanceStep = static_cast<MaintenanceStep>(m_maintenanceStep + 1);
+        }
+    }
+    m_maintenanceTime += timer.elapsed();
+
+    if (m_maintenanceStep == MaintenanceDone) {
+        ++m_maintenanceRuns;
+        m_lastMaintenance.start();
+#if DEBUG_LOGS
+        qDebug() << "maintenance done, reclaimed" << m_reclaimedBytes << "bytes in" << m_maintenanceTime << "ms";
+#endif
+    } else if (m_maintenanceAllowed.load()) {
+        m_maintenanceTimer.start();
+    }
+}
+
+// Returns true if the current step has work left
+bool DBWorker::runMaintenanceStep(const QElapsedTimer &timer)
+{
+    switch (m_maintenanceStep) {
+    case AnalyzeStep: {
+        QSqlQuery query = prepare("PRAGMA analysis_limit = " STR(ANALYSIS_LIMIT) ";");
+        execute(query);
+        query.finish();
+        // Without any statistics PRAGMA optimize would skip most tables
+        bool analyzed = integerQuery("SELECT COUNT(*) FROM sqlite_master WHERE name = 'sqlite_stat1';") > 0;
+        resetStatementCache();
+        query = prepare(analyzed ? "PRAGMA optimize;" : "ANALYZE;");
+        execute(query);
+        query.finish();
+        return false;
+    }
+    case VacuumStep: {
+        qint64 pageSize = integerQuery("PRAGMA page_size;");
+        int pageCount = integerQuery("PRAGMA page_count;");
+        bool incremental = integerQuery("PRAGMA auto_vacuum;") == 2;
+        int freePages = integerQuery("PRAGMA freelist_count;");
+        resetStatementCache();
+
+        // Databases too large to be converted at startup are not compacted,
+        // see enableIncrementalVacuum().
+        if (incremental && freePages > 0) {
+            QSqlQuery query = prepare("PRAGMA incremental_vacuum(" STR(INCREMENTAL_VACUUM_PAGES) ");");
+            // Each step of the pragma frees one page
+            while (!timer.hasExpired(MAINTENANCE_SLICE_BUDGET) && m_maintenanceAllowed.load()
+                   && execute(query)) {
+                while (query.next()) {
+                }
+                if (integerQuery("PRAGMA freelist_count;") == 0) {
+                    break;
+                }
+            }
+            query.finish();
+        }
+
+        int reclaimedPages = pageCount - integerQuery("PRAGMA page_count;");
+        int leftPages = integerQuery("PRAGMA freelist_count;");
+        resetStatementCache();
+        m_reclaimedBytes += qMax(0, reclaimedPages) * pageSize;
+        return incremental && leftPages > 0 && reclaimedPages > 0;
+    }
+    case CheckpointStep: {
+        if (m_walEnabled) {
+            // Also gives the space of the WAL file back
+            QSqlQuery query = prepare("PRAGMA wal_checkpoint(TRUNCATE);");
             execute(query);
+            query.finish();
+        }
+        return false;
+    }
+    case MaintenanceDone:
+        break;
+    }
+    return false;
+}
+
+// Returns the SQLite connection behind the Qt one
+static sqlite3 *sqliteHandle(const QSqlDatabase &database)
+{
+    QVariant handle = database.driver()->handle();
+    if (handle.isValid() && qstrcmp(handle.typeName(), "sqlite3*") == 0) {
+        return *static_cast<sqlite3 **>(handle.data());
+    }
+    return 0;
+}
+
+// Writes a consistent copy of the database to path using the online backup
+// API, emits backupFinished() when done. The copy is made in steps between
+// the other calls. Writes made meanwhile go through the same connection and
+// are carried over to the copy, so the backup never has to start over.
+void DBWorker::backup(const QString &path)
+{
+    if (m_backup) {
+        if (path != m_backupPath) {
+            qWarning() << "Database backup to" << m_backupPath << "already running";
+            emit backupFinished(path, false);
+        }
+        return;
+    }
+
+    sqlite3 *source = m_database.isOpen() && m_sqliteLinked ? sqliteHandle(m_database) : 0;
+    if (!source || path.isEmpty()) {
+        ++m_failedBackups;
+        emit backupFinished(path, false);
+        return;
+    }
+
+    m_backupPath = path;
+    const QString partialPath = path + QLatin1String(".part");
+    QFile::remove(partialPath);
+    if (sqlite3_open_v2(QFile::encodeName(partialPath).constData(), &m_backupDatabase,
+                        SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, 0) != SQLITE_OK) {
+        qWarning() << "Failed to create database backup" << partialPath
+                   << sqlite3_errmsg(m_backupDatabase);
+        finishBackup(false);
+        return;
+    }
+
+    m_backup = sqlite3_backup_init(m_backupDatabase, "main", source, "main");
+    if (!m_backup) {
+        qWarning() << "Failed to start database backup" << sqlite3_errmsg(m_backupDatabase);
+        finishBackup(false);
+        return;
+    }
+
+#if DEBUG_LOGS
+    qDebug() << "database backup to" << path << "started";
+#endif
+    backupStep();
+}
+
+void DBWorker::backupStep()
+{
+    if (!m_backup || deferBackgroundWork(&m_backupTimer, BACKUP_STEP_INTERVAL)) {
+        return;
+    }
+    BackgroundScope scope;
+
+    // Pages of an uncommitted batch must not end up in the copy
+    flush();
+    resetStatementCache();
+
+    int result = sqlite3_backup_step(m_backup, BACKUP_STEP_PAGES);
+    switch (result) {
+    case SQLITE_DONE:
+        finishBackup(true);
+        break;
+    case SQLITE_OK:
+    case SQLITE_BUSY:
+    case SQLITE_LOCKED:
+        m_backupTimer.start();
+        break;
+    default:
+        qWarning() << "Database backup failed:" << sqlite3_errstr(result);
+        finishBackup(false);
+        break;
+    }
+}
+
+void DBWorker::finishBackup(bool ok)
+{
+    m_backupTimer.stop();
+    if (m_backup) {
+        if (sqlite3_backup_finish(m_backup) != SQLITE_OK) {
+            ok = false;
+        }
+        m_backup = 0;
+    }
+
+    const QString partialPath = m_backupPath + QLatin1String(".part");
+    if (m_backupDatabase) {
+        // A copy of a WAL database would be in WAL mode as well, the
+        // archived copy should be a single file.
+        if (ok && sqlite3_exec(m_backupDatabase, "PRAGMA journal_mode = DELETE;", 0, 0, 0) != SQLITE_OK) {
+            qWarning() << "Failed to set journal mode of database backup" << sqlite3_errmsg(m_backupDatabase);
+            ok = false;
+        }
+        sqlite3_close(m_backupDatabase);
+        m_backupDatabase = 0;
+    }
+
+    if (ok) {
+        QFile::remove(m_backupPath);
+        ok = QFile::rename(partialPath, m_backupPath);
+    }
+    if (!ok) {
+        QFile::remove(partialPath);
+        ++m_failedBackups;
+    } else {
+        ++m_backupCount;
+    }
+
+#if DEBUG_LOGS
+    qDebug() << "database backup to" << m_backupPath << "finished, ok:" << ok;
+#endif
+
+    const QString path = m_backupPath;
+    m_backupPath.clear();
+    emit backupFinished(path, ok);
+}
+
+void DBWorker::flush()
+{
+    if (!m_batcher.flush()) {
+        qWarning() << "Failed to commit pending writes";
+    }
+    publishWrites();
+}
+
+void DBWorker::getStatistics()
+{
+    QVariantMap statements;
+    statements.insert(QStringLiteral("cached"), m_statementCache.count());
+    statements.insert(QStringLiteral("hits"), m_statementCacheHits);
+    statements.insert(QStringLiteral("misses"), m_statementCacheMisses);
+
+    QVariantMap journal;
+    journal.insert(QStringLiteral("wal"), m_walEnabled);
+    journal.insert(QStringLiteral("checkpoints"), m_checkpointCount);
+    journal.insert(QStringLiteral("checkpointedPages"), m_checkpointedPages);
+
+    QVariantMap expiry;
+    expiry.insert(QStringLiteral("maxEntries"), m_historyMaxEntries);
+    expiry.insert(QStringLiteral("maxBytes"), m_historyMaxBytes);
+    expiry.insert(QStringLiteral("historyBytes"), m_database.isOpen() ? historyBytes() : 0);
+    expiry.insert(QStringLiteral("batches"), m_expiryBatches);
+    expiry.insert(QStringLiteral("expiredEntries"), m_expiredEntries);
+    expiry.insert(QStringLiteral("collectedLinks"), m_collectedLinks);
+
+    QVariantMap maintenance;
+    maintenance.insert(QStringLiteral("runs"), m_maintenanceRuns);
+    maintenance.insert(QStringLiteral("running"), m_maintenanceStep != MaintenanceDone);
+    // Milliseconds spent in maintenance
+    maintenance.insert(QStringLiteral("time"), m_maintenanceTime);
+    maintenance.insert(QStringLiteral("reclaimedBytes"), m_reclaimedBytes);
+
+    QVariantMap backup;
+    backup.insert(QStringLiteral("running"), m_backup != 0);
+    backup.insert(QStringLiteral("completed"), m_backupCount);
+    backup.insert(QStringLiteral("failed"), m_failedBackups);
+
+    QVariantMap scheduling;
+    scheduling.insert(QStringLiteral("foregroundTasks"), m_foregroundTaskCount);
+    scheduling.insert(QStringLiteral("backgroundTasks"), m_backgroundTaskCount);
+    // Background tasks run early for a call needing their results
+    scheduling.insert(QStringLiteral("promotedTasks"), m_promotedTaskCount);
+    // Timer work postponed for queued tasks
+    scheduling.insert(QStringLiteral("deferredWork"), m_deferredWorkCount);
+    // Milliseconds spent in background tasks
+    scheduling.insert(QStringLiteral("backgroundTime"), m_backgroundTime);
+    {
+        QMutexLocker locker(&m_backgroundMutex);
+        scheduling.insert(QStringLiteral("maxBackgroundQueue"), m_maxBackgroundQueue);
+    }
+
+    QVariantMap stats;
+    stats.insert(QStringLiteral("transactions"), m_batcher.statistics());
+    stats.insert(QStringLiteral("scheduling"), scheduling);
+    stats.insert(QStringLiteral("maintenance"), maintenance);
+    stats.insert(QStringLiteral("backup"), backup);
+    stats.insert(QStringLiteral("journal"), journal);
+    stats.insert(QStringLiteral("expiry"), expiry);
+    stats.insert(QStringLiteral("statements"), statements);
+    if (m_profiler) {
+        stats.insert(QStringLiteral("profile"), m_profiler->statistics());
+    }
+    emit statisticsAvailable(stats);
+}
+
+void DBWorker::setUserVersion(int userVersion)
+{
+    QSqlQuery updateQuery = prepare(QString("PRAGMA user_version = %1;").arg(userVersion));
+    if (!execute(updateQuery)) {
+        qWarning() << "Failed to update schema user version";
+    }
+}
+
+// Links are only referred to by tab history entries. The trigger removes a
+// link together with the last entry referring to it; links orphaned before
+// it existed are removed by DBWorker::collectLinks().
+static const char *db_link_release[] = {
+    "CREATE TRIGGER tab_history_link_release AFTER DELETE ON tab_history "
+    "WHEN NOT EXISTS (SELECT 1 FROM tab_history WHERE link_id = old.link_id) BEGIN "
+    "DELETE FROM link WHERE link_id = old.link_id; "
+    "END;"
+};
+static int db_link_release_count = sizeof(db_link_release) / sizeof(*db_link_release);
+
+// Urls are looked up by a 64-bit hash, see DBWorker::urlHash(). The index
+// on the hash replaces the unique index on the url text, the table is
+// rebuilt to drop the latter. Triggers and the view referring to the url
+// table by name keep working after the rename in legacy mode.
+static const char *db_url_hash[] = {
+    "CREATE TABLE url_hashed (id INTEGER PRIMARY KEY,\n"
+    "url TEXT NOT NULL,\n"
+    "hash INTEGER NOT NULL,\n"
+    "refcount INTEGER NOT NULL DEFAULT 0\n"
+    ");"
+};
+static int db_url_hash_count = sizeof(db_url_hash) / sizeof(*db_url_hash);
+
+static const char *db_url_hash_swap[] = {
+    "DROP TABLE url;",
+    "PRAGMA legacy_alter_table = ON;",
+    "ALTER TABLE url_hashed RENAME TO url;",
+    "PRAGMA legacy_alter_table = OFF;",
+    "CREATE INDEX url_hash ON url (hash);",
+    "CREATE INDEX url_unreferenced ON url (id) WHERE refcount <= 0;"
+};
+static int db_url_hash_swap_count = sizeof(db_url_hash_swap) / sizeof(*db_url_hash_swap);
+
+// Brings the schema up to date by running the migration steps newer than the
+// current user version in order. Each step runs in its own transaction together
+// with the user version update, so a failing step leaves the database as it was.
+void DBWorker::migrate()
+{
+    struct Migration {
+        int version;
+        const char *description;
+        bool (DBWorker::*migrate)();
+    };
+
+    static const Migration migrations[] = {
+        { 1, "move history to browser_history", &DBWorker::migrateTo_1 },
+        { 2, "add indices", &DBWorker::migrateTo_2 },
+        { 3, "add full text index for history", &DBWorker::migrateTo_3 },
+        { 4, "add visits and frecency", &DBWorker::migrateTo_4 },
+        { 5, "intern urls", &DBWorker::migrateTo_5 },
+        { 6, "release links with tab history", &DBWorker::migrateTo_6 },
+        { 7, "hash urls", &DBWorker::migrateTo_7 }
+    };
+    static const int migrationCount = sizeof(migrations) / sizeof(*migrations);
+
+    QSqlQuery schemaQuery = prepare("PRAGMA user_version;");
+    if (!execute(schemaQuery) || !schemaQuery.first()) {
+        qWarning() << "Failed to check schema version";
+        return;
+    }
+    int userVersion = schemaQuery.value(0).toInt();
+    schemaQuery.finish();
+
+    for (int i = 0; i < migrationCount; ++i) {
+        const Migration &migration = migrations[i];
+        if (migration.version <= userVersion) {
+            continue;
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+
+        // Schema changes fail while earlier statements still have rows pending
+        resetStatementCache();
+        if (!m_database.transaction()) {
+            qCritical() << "Failed to begin migration to schema version" << migration.version
+                        << m_database.lastError();
+            return;
+        }
+
+        bool ok = (this->*migration.migrate)();
+        if (ok) {
+            setUserVersion(migration.version);
+            ok = m_database.commit();
+        }
+
+        if (!ok) {
+            qCritical() << "Failed to migrate to schema version" << migration.version
+                        << "(" << migration.description << ")" << m_database.lastError();
+            m_database.rollback();
+            return;
+        }
+
+#if DEBUG_LOGS
+        qDebug() << "Migrated to schema version" << migration.version
+                 << "(" << migration.description << ") in" << timer.elapsed() << "ms";
+#endif
+        userVersion = migration.version;
+    }
+}
+
+// This method migrates data from history table (introduced in 42dbd01d23bc90cf1f5e177ceeefc05c91aa19cd) to browser_history table
+bool DBWorker::migrateTo_1()
+{
+    // Check if browser_history table exists
+    QSqlQuery browser_history_table_exists = prepare("SELECT name FROM sqlite_master WHERE type='table' AND name='browser_history';");
+    if (!execute(browser_history_table_exists)) {
+        qCritical() << "Failed to query for browser_history table";
+        return false;
+    }
+    if (!browser_history_table_exists.first()) {
+        // browser_history table does not exist, let's create it
+        browser_history_table_exists.finish();
+        QSqlQuery create_browser_history_table = prepare(create_table_browser_history);
+        if (!execute(create_browser_history_table)) {
+            qCritical() << "Failed to create browser_history table";
+            return false;
+        }
+    }
+    browser_history_table_exists.finish();
+
+    QSqlQuery history_table_exists = prepare("SELECT name FROM sqlite_master WHERE type='table' AND name='history';");
+    if (!execute(history_table_exists)) {
+        qCritical() << "Failed to query for history table";
+        return false;
+    }
+    if (history_table_exists.first()) {
+        // history table exists, migrate all it's data to browser_history table and delete it
+        history_table_exists.finish();
+
+        QSqlQuery update_browser_history = prepare("INSERT INTO browser_history (url, title, date) select "\
+                                           "link.url, link.title, history.date from link, history where "\
+                                           "history.link_id = link.link_id and NULLIF(link.title, '') IS NOT NULL and "\
+                                           "link.link_id in (select MAX(link_id) from link group by url);");
+        if (!execute(update_browser_history)) {
+            qCritical() << "Failed to update browser history";
+            return false;
+        }
+
+        QSqlQuery delete_history_table = prepare("DROP TABLE history;");
+        if (!execute(delete_history_table)) {
+            qCritical() << "Failed to delete history table";
+            return false;
+        }
+    }
+    history_table_exists.finish();
+
+    return true;
+}
+
+// Adds indices for the tab history lookups (current link, tab history, back/forward
+// and clearing of deprecated entries), link cleanup and the history listing.
+bool DBWorker::migrateTo_2()
+{
+    for (int i = 0; i < db_indices_count; ++i) {
+        QSqlQuery query = prepare(db_indices[i]);
+        if (!execute(query)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Adds a full text index for history search. Uses FTS5 when available, otherwise
+// FTS4. Without either the history search keeps using LIKE patterns.
+bool DBWorker::migrateTo_3()
+{
+    QSqlQuery query = prepare(db_history_fts5[0]);
+    bool fts5 = query.exec();
+    if (!fts5) {
+        query = prepare(db_history_fts4[0]);
+        if (!query.exec()) {
+            qWarning() << "Full text search is not available, history search uses pattern matching";
+            return true;
+        }
+    }
+
+    const char **statements = fts5 ? db_history_fts5 : db_history_fts4;
+    int count = fts5 ? db_history_fts5_count : db_history_fts4_count;
+    for (int i = 1; i < count; ++i) {
+        query = prepare(statements[i]);
+        if (!execute(query)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Adds the per-visit log and the frecency score used for ranking history. Scores
+// of existing entries are estimated from their visit count and last visit.
+bool DBWorker::migrateTo_4()
+{
+    for (int i = 0; i < db_visits_count; ++i) {
+        QSqlQuery query = prepare(db_visits[i]);
+        if (!execute(query)) {
+            return false;
+        }
+    }
+
+    QSqlQuery query = prepare("SELECT id, date, visited_count FROM browser_history;");
+    if (!execute(query)) {
+        return false;
+    }
+    QList<QPair<int, double> > scores;
+    while (query.next()) {
+        scores.append(qMakePair(query.value(0).toInt(),
+                                query.value(2).toInt() * visitScore(query.value(1).toLongLong(), VisitLink)));
+    }
+    query.finish();
+
+    query = prepare("UPDATE browser_history SET frecency = ? WHERE id = ?;");
+    for (int i = 0; i < scores.count(); ++i) {
+        query.bindValue(0, scores.at(i).second);
+        query.bindValue(1, scores.at(i).first);
+        if (!execute(query)) {
+            return false;
         }
-    } else {
-        // Limit history size to 2000 entries
-        QSqlQuery cleanupHistory = prepare("DELETE FROM browser_history WHERE id NOT IN (SELECT id from browser_history"\
-                                           " ORDER BY date DESC LIMIT " STR(MAX_BROWSER_HISTORY_SIZE) ");");
-        if (!execute(cleanupHistory)) {
-            qWarning() << "Failed to clear older history items";
+    }
+    return true;
+}
+
+// Moves urls of links and history entries to the url dictionary table. The
+// full text index is recreated on top of it if there was one.
+bool DBWorker::migrateTo_5()
+{
+    QString ftsSchema = textQuery("SELECT sql FROM sqlite_master WHERE type = 'table' AND name = 'browser_history_fts';");
+    bool fts5 = ftsSchema.contains(QLatin1String("fts5"), Qt::CaseInsensitive);
+    bool fts4 = ftsSchema.contains(QLatin1String("fts4"), Qt::CaseInsensitive);
+    resetStatementCache();
+
+    for (int i = 0; i < db_url_dictionary_count; ++i) {
+        QSqlQuery query = prepare(db_url_dictionary[i]);
+        if (!execute(query)) {
+            return false;
         }
     }
 
-    // check current schema version and migrate if needed
-    QSqlQuery schemaQuery = prepare("PRAGMA user_version;");
-    if (execute(schemaQuery) && schemaQuery.next()) {
-        int userVersion = schemaQuery.value(0).toInt();
-        if (userVersion == 0) {
-            migrateTo_1();
+    // The old index triggers went away with the old browser_history table.
+    if (fts5 || fts4) {
+        QSqlQuery query = prepare("DROP TABLE browser_history_fts;");
+        if (!execute(query)) {
+            return false;
         }
-    } else {
-        qWarning() << "Failed to check schema version";
     }
 
-    m_updateThumbPathQuery = prepare("UPDATE link SET thumb_path = ? "
-                                     "WHERE link_id IN (SELECT link.link_id "
-                                     "FROM tab_history INNER JOIN link ON tab_history.link_id=link.link_id WHERE tab_history.tab_id = ?);");
+    const char **statements = fts5 ? db_history_text_fts5 : db_history_text_fts4;
+    int count = fts5 ? db_history_text_fts5_count : (fts4 ? db_history_text_fts4_count : 0);
+    for (int i = 0; i < count; ++i) {
+        QSqlQuery query = prepare(statements[i]);
+        if (!execute(query)) {
+            return false;
+        }
+    }
+    return true;
 }
 
-void DBWorker::setUserVersion(int userVersion)
+// Removes links along with their last tab history entry. Existing orphans are
+// left to collectLinks(), which runs in the background.
+bool DBWorker::migrateTo_6()
 {
-    QSqlQuery updateQuery = prepare(QString("PRAGMA user_version = %1;").arg(userVersion));
-    if (!execute(updateQuery)) {
-        qWarning() << "Failed to update schema user version";
+    for (int i = 0; i < db_link_release_count; ++i) {
+        QSqlQuery query = prepare(db_link_release[i]);
+        if (!execute(query)) {
+            return false;
+        }
     }
+    return true;
 }
 
-// This method migrates data from history table (introduced in 42dbd01d23bc90cf1f5e177ceeefc05c91aa19cd) to browser_history table
-void DBWorker::migrateTo_1() {
-    // Check if browser_history table exists
-    QSqlQuery browser_history_table_exists = prepare("SELECT name FROM sqlite_master WHERE type='table' AND name='browser_history';");
-    if(execute(browser_history_table_exists)) {
-        if (!browser_history_table_exists.first()) {
-            // browser_history table does not exist, let's create it
-            browser_history_table_exists.clear();
-            QSqlQuery create_browser_history_table = prepare(create_table_browser_history);
-            if (!execute(create_browser_history_table)) {
-                qCritical() << "Failed to create browser_history table";
-            }
+bool DBWorker::migrateTo_7()
+{
+    for (int i = 0; i < db_url_hash_count; ++i) {
+        QSqlQuery query = prepare(db_url_hash[i]);
+        if (!execute(query)) {
+            return false;
         }
-    } else {
-        qCritical() << "Failed to query for browser_history table";
     }
 
-    QSqlQuery history_table_exists = prepare("SELECT name FROM sqlite_master WHERE type='table' AND name='history';");
-    if(execute(history_table_exists)) {
-        if (history_table_exists.first()) {
-            // history table exists, migrate all it's data to browser_history table and delete it
-            history_table_exists.clear();
-
-            QSqlQuery update_browser_history = prepare("INSERT INTO browser_history (url, title, date) select "\
-                                               "link.url, link.title, history.date from link, history where "\
-                                               "history.link_id = link.link_id and NULLIF(link.title, '') IS NOT NULL and "\
-                                               "link.link_id in (select MAX(link_id) from link group by url);");
-
-
-            if (!execute(update_browser_history)) {
-                qCritical() << "Failed to update browser history";
-            }
-
-            QSqlQuery delete_history_table = prepare("DROP TABLE history;");
-            if (!execute(delete_history_table)) {
-                qCritical() << "Failed to delete history table";
-            }
+    // Hashes are computed here, SQLite does not know the function
+    QSqlQuery select = prepare("SELECT id, url, refcount FROM url;");
+    QSqlQuery insert = prepare("INSERT INTO url_hashed (id, url, hash, refcount) VALUES (?, ?, ?, ?);");
+    if (!execute(select)) {
+        return false;
+    }
+    while (select.next()) {
+        const QString url = select.value(1).toString();
+        insert.bindValue(0, select.value(0));
+        insert.bindValue(1, url);
+        insert.bindValue(2, urlHash(url));
+        insert.bindValue(3, select.value(2));
+        if (!execute(insert)) {
+            return false;
         }
-    } else {
-        qCritical() << "Failed to query for history table";
     }
-
-    setUserVersion(1);
+    select.finish();
+    insert.finish();
+    // The old table cannot be dropped while statements on it are cached
+    clearStatementCache();
+
+    for (int i = 0; i < db_url_hash_swap_count; ++i) {
+        QSqlQuery query = prepare(db_url_hash_swap[i]);
+        if (!execute(query)) {
+            return false;
+        }
+    }
+    return true;
 }
 
+// Returns a prepared query for the statement. Each distinct statement is prepared
+// only once, further calls reset the cached query so that it can be rebound.
 QSqlQuery DBWorker::prepare(const QString &statement)
 {
+    if (m_statementCacheEnabled) {
+        QHash<QString, QSqlQuery>::iterator cached = m_statementCache.find(statement);
+        if (cached != m_statementCache.end()) {
+            ++m_statementCacheHits;
+            cached->finish();
+            return *cached;
+        }
+    }
+
+    ++m_statementCacheMisses;
     QSqlQuery query(m_database);
     query.setForwardOnly(true);
     if (!query.prepare(statement)) {
@@ -196,12 +1664,48 @@ QSqlQuery DBWorker::prepare(const QString &statement)
         qWarning() << query.lastError();
         return QSqlQuery();
     }
+
+    if (m_statementCacheEnabled) {
+        m_statementCache.insert(statement, query);
+    }
     return query;
 }
 
+void DBWorker::clearStatementCache()
+{
+    m_statementCache.clear();
+}
+
+void DBWorker::resetStatementCache()
+{
+    QHash<QString, QSqlQuery>::iterator it = m_statementCache.begin();
+    for (; it != m_statementCache.end(); ++it) {
+        it->finish();
+    }
+}
+
 bool DBWorker::execute(QSqlQuery &query)
 {
-    if (!query.exec()) {
+    bool profiling = m_profiler && m_profiler->isEnabled();
+    QElapsedTimer timer;
+    if (profiling) {
+        timer.start();
+    }
+
+    bool ok = query.exec();
+
+    if (profiling) {
+        // SELECT statements are stepped by the caller, rows are counted for
+        // the other statements only.
+        m_profiler->record(query.lastQuery(), timer.nsecsElapsed(),
+                           ok && !query.isSelect() ? query.numRowsAffected() : 0);
+    }
+
+    if (!ok) {
+        // Interrupted as a newer search is waiting, not an error
+        if (searchSuperseded()) {
+            return false;
+        }
         qWarning() << Q_FUNC_INFO << "failed execute query";
         qWarning() << query.lastQuery();
         qWarning() << query.lastError();
@@ -215,24 +1719,29 @@ void DBWorker::createTab(const Tab &tab)
 #if DEBUG_LOGS
     qDebug() << "new tab id: " << tab.tabId();
 #endif
+    m_batcher.addWrite();
     QSqlQuery query = prepare("INSERT INTO tab (tab_id, tab_history_id) VALUES (?,?);");
     query.bindValue(0, tab.tabId());
     query.bindValue(1, 0);
-    execute(query);
+    if (execute(query)) {
+        m_tabHistories.insert(tab.tabId(), TabHistory());
+    }
 
     if (tab.url().isEmpty()) {
         return;
     }
 
-    int linkId = createLink(tab.url(), tab.title(), tab.thumbnailPath());
+    int urlId = internUrl(tab.url());
+    int linkId = createLink(urlId, tab.title(), tab.thumbnailPath());
 
-    if (addToBrowserHistory(tab.url(), tab.title()) == Error) {
+    if (addToBrowserHistory(tab.url(), urlId, tab.title(), VisitNewTab) == Error) {
         qWarning() << Q_FUNC_INFO << "failed to add url to history" << tab.url();
     }
 
     int historyId = addToTabHistory(tab.tabId(), linkId);
     if (historyId > 0) {
         updateTab(tab.tabId(), historyId);
+        appendTabHistory(tab.tabId(), historyId, Link(linkId, tab.url(), tab.thumbnailPath(), tab.title()));
     } else {
         qWarning() << Q_FUNC_INFO << "failed to add url to tab history" << tab.url();
     }
@@ -258,22 +1767,17 @@ void DBWorker::removeTab(int tabId)
 #if DEBUG_LOGS
     qDebug() << "tab id:" << tabId;
 #endif
+    m_batcher.addWrite();
     QSqlQuery query = prepare("DELETE FROM tab WHERE tab_id = ?;");
     query.bindValue(0, tabId);
     execute(query);
 
-    // Remove links that are only related to this tab
-    query = prepare("DELETE FROM link WHERE link_id IN "
-                    "(SELECT DISTINCT link_id FROM tab_history WHERE tab_id = ? "
-                    "AND link_id NOT IN (SELECT link_id FROM tab_history WHERE tab_id != ? "
-                    "))");
-    query.bindValue(0, tabId);
-    query.bindValue(1, tabId);
-
-    // Remove history
+    // Remove history, links only related to this tab go with it
     query = prepare("DELETE FROM tab_history WHERE tab_id = ?;");
     query.bindValue(0, tabId);
     execute(query);
+    releaseUrls();
+    m_tabHistories.remove(tabId);
 
     // Check last tab closed
     if (!tabCount()) {
@@ -284,6 +1788,7 @@ void DBWorker::removeTab(int tabId)
 
 void DBWorker::removeAllTabs(bool noFeedback)
 {
+    m_batcher.addWrite();
     int oldTabCount(0);
 
     if (!noFeedback) {
@@ -293,14 +1798,14 @@ void DBWorker::removeAllTabs(bool noFeedback)
     QSqlQuery query = prepare("DELETE FROM tab;");
     execute(query);
 
-    // Remove links that are not stored in history
-    query = prepare("DELETE FROM link WHERE link_id IN "
-                    "(SELECT DISTINCT link_id FROM tab_history)");
-    execute(query);
-
-    // Remove history
+    // Remove history together with the links of the tabs
     query = prepare("DELETE FROM tab_history;");
     execute(query);
+    releaseUrls();
+    m_tabHistories.clear();
+
+    // Typically called while closing the browser, commit right away.
+    flush();
 
     QList<Tab> tabList;
     if (oldTabCount != 0) {
@@ -310,11 +1815,15 @@ void DBWorker::removeAllTabs(bool noFeedback)
 
 void DBWorker::getAllTabs()
 {
+    // Thumbnails and titles are written by background tasks
+    runBackgroundTasks();
+
     QList<Tab> tabList;
-    QSqlQuery query = prepare("SELECT tab.tab_id, link.url, link.title, link.thumb_path "
+    QSqlQuery query = prepare("SELECT tab.tab_id, url.url, link.title, link.thumb_path "
                               "FROM tab "
                               "INNER JOIN tab_history ON tab_history.id = tab.tab_history_id "
-                              "INNER JOIN link ON tab_history.link_id = link.link_id;");
+                              "INNER JOIN link ON tab_history.link_id = link.link_id "
+                              "INNER JOIN url ON url.id = link.url_id;");
     if (!execute(query)) {
         return;
     }
@@ -333,9 +1842,17 @@ int DBWorker::getMaxTabId()
     return integerQuery("SELECT MAX(tab_id) FROM tab;");
 }
 
+void DBWorker::saveSession(const QList<Tab> &tabs, int activeTabId)
+{
+    // Commit first, a snapshot restored at startup must not contain tabs
+    // that were lost from the database.
+    flush();
+    SessionSnapshot::save(tabs, activeTabId);
+}
+
 int DBWorker::tabCount()
 {
-    return integerQuery("SELECT COUNT(*) FROM tab;");
+    return m_tabHistories.count();
 }
 
 int DBWorker::integerQuery(const QString &statement)
@@ -349,6 +1866,17 @@ int DBWorker::integerQuery(const QString &statement)
     return 0;
 }
 
+QString DBWorker::textQuery(const QString &statement)
+{
+    QSqlQuery query = prepare(statement);
+    if (execute(query)) {
+        if (query.first()) {
+            return query.value(0).toString();
+        }
+    }
+    return QString();
+}
+
 void DBWorker::navigateTo(int tabId, const QString &url, const QString &title, const QString &path) {
     // TODO: rollback in case of failure
     if (url.isEmpty()) {
@@ -361,17 +1889,20 @@ void DBWorker::navigateTo(int tabId, const QString &url, const QString &title, c
         return;
     }
 
+    m_batcher.addWrite();
     clearDeprecatedTabHistory(tabId, currentLink.linkId());
 
-    int linkId = createLink(url, title, path);
+    int urlId = internUrl(url);
+    int linkId = createLink(urlId, title, path);
 
-    if (addToBrowserHistory(url, title) == Error) {
+    if (addToBrowserHistory(url, urlId, title, VisitLink) == Error) {
         qWarning() << Q_FUNC_INFO << "failed to add url to history" << url;
     }
 
     int historyId = addToTabHistory(tabId, linkId);
     if (historyId > 0) {
         updateTab(tabId, historyId);
+        appendTabHistory(tabId, historyId, Link(linkId, url, path, title));
     } else {
         qWarning() << Q_FUNC_INFO << "failed to add url to tab history" << url;
     }
@@ -382,58 +1913,39 @@ void DBWorker::navigateTo(int tabId, const QString &url, const QString &title, c
 }
 
 void DBWorker::goForward(int tabId) {
-    QSqlQuery query = prepare("SELECT id FROM tab_history WHERE tab_id = ? AND id > (SELECT tab_history_id FROM tab WHERE tab_id = ?) ORDER BY id ASC LIMIT 1;");
-    query.bindValue(0, tabId);
-    query.bindValue(1, tabId);
-    if (!execute(query)) {
-        return;
-    }
-
-    int historyId = 0;
-    if (query.first()) {
-        historyId = query.value(0).toInt();
-    }
-
-    if (historyId > 0) {
-        updateTab(tabId, historyId);
-    }
+    moveInTabHistory(tabId, 1);
 }
 
 void DBWorker::goBack(int tabId) {
-    QSqlQuery query = prepare("SELECT id FROM tab_history WHERE tab_id = ? AND id < (SELECT tab_history_id FROM tab WHERE tab_id = ?) ORDER BY id DESC LIMIT 1;");
-    query.bindValue(0, tabId);
-    query.bindValue(1, tabId);
-    if (!execute(query)) {
+    moveInTabHistory(tabId, -1);
+}
+
+// Moves the current entry of the tab by offset. The cursor is kept in memory,
+// only the new position is written.
+void DBWorker::moveInTabHistory(int tabId, int offset)
+{
+    QHash<int, TabHistory>::iterator tabHistory = m_tabHistories.find(tabId);
+    if (tabHistory == m_tabHistories.end()) {
         return;
     }
 
-    int historyId = 0;
-    if (query.first()) {
-        historyId = query.value(0).toInt();
+    int index = tabHistory->current + offset;
+    if (tabHistory->current < 0 || index < 0 || index >= tabHistory->entries.count()) {
+        return;
     }
 
-    if (historyId > 0) {
-        updateTab(tabId, historyId);
-    }
+    m_batcher.addWrite();
+    tabHistory->current = index;
+    updateTab(tabId, tabHistory->entries.at(index).historyId);
 }
 
 Link DBWorker::getCurrentLink(int tabId)
 {
-    QSqlQuery query = prepare("SELECT link.link_id, link.url, link.thumb_path, link.title "
-                              "FROM tab "
-                              "INNER JOIN tab_history ON tab_history.id = tab.tab_history_id "
-                              "INNER JOIN link ON tab_history.link_id = link.link_id "
-                              "WHERE tab.tab_id = ?;");
-    query.bindValue(0, tabId);
-    if (execute(query)) {
-        if (query.first()) {
-            return Link(query.value(0).toInt(),
-                        query.value(1).toString(),
-                        query.value(2).toString(),
-                        query.value(3).toString());
-        }
+    QHash<int, TabHistory>::const_iterator tabHistory = m_tabHistories.constFind(tabId);
+    if (tabHistory == m_tabHistories.constEnd() || tabHistory->current < 0) {
+        return Link();
     }
-    return Link();
+    return tabHistory->entries.at(tabHistory->current).link;
 }
 
 void DBWorker::clearDeprecatedTabHistory(int tabId, int currentLinkId) {
@@ -444,59 +1956,162 @@ void DBWorker::clearDeprecatedTabHistory(int tabId, int currentLinkId) {
     query.bindValue(0, tabId);
     query.bindValue(1, currentLinkId);
     execute(query);
+
+    QHash<int, TabHistory>::iterator tabHistory = m_tabHistories.find(tabId);
+    if (tabHistory != m_tabHistories.end()) {
+        tabHistory->entries.erase(tabHistory->entries.begin() + tabHistory->current + 1,
+                                  tabHistory->entries.end());
+    }
+}
+
+// Adds a new current entry to the end of the cached history of the tab
+void DBWorker::appendTabHistory(int tabId, int historyId, const Link &link)
+{
+    QHash<int, TabHistory>::iterator tabHistory = m_tabHistories.find(tabId);
+    if (tabHistory != m_tabHistories.end()) {
+        tabHistory->entries.append(TabHistoryEntry(historyId, link));
+        tabHistory->current = tabHistory->entries.count() - 1;
+    }
+}
+
+// Reads the history of all tabs into memory. Afterwards the history of a tab
+// is served from memory and changes to it are written through to the database.
+void DBWorker::loadTabHistories()
+{
+    m_tabHistories.clear();
+
+    QSqlQuery query = prepare("SELECT tab_id, tab_history_id FROM tab;");
+    if (!execute(query)) {
+        return;
+    }
+    QHash<int, int> currentHistoryIds;
+    while (query.next()) {
+        m_tabHistories.insert(query.value(0).toInt(), TabHistory());
+        currentHistoryIds.insert(query.value(0).toInt(), query.value(1).toInt());
+    }
+
+    query = prepare("SELECT tab_history.tab_id, tab_history.id, link.link_id, url.url, link.thumb_path, link.title "
+                    "FROM tab_history "
+                    "INNER JOIN link ON tab_history.link_id = link.link_id "
+                    "INNER JOIN url ON url.id = link.url_id "
+                    "ORDER BY tab_history.tab_id, tab_history.id;");
+    if (!execute(query)) {
+        return;
+    }
+    while (query.next()) {
+        int tabId = query.value(0).toInt();
+        QHash<int, TabHistory>::iterator tabHistory = m_tabHistories.find(tabId);
+        if (tabHistory == m_tabHistories.end()) {
+            continue;
+        }
+
+        int historyId = query.value(1).toInt();
+        if (historyId == currentHistoryIds.value(tabId)) {
+            tabHistory->current = tabHistory->entries.count();
+        }
+        tabHistory->entries.append(TabHistoryEntry(historyId, Link(query.value(2).toInt(),
+                                                                   query.value(3).toString(),
+                                                                   query.value(4).toString(),
+                                                                   query.value(5).toString())));
+    }
+    query.finish();
 }
 
 // Adds url to table history if it is not already there
-HistoryResult DBWorker::addToBrowserHistory(const QString &url, const QString &title)
+HistoryResult DBWorker::addToBrowserHistory(const QString &url, int urlId, const QString &title, VisitTransition transition)
 {
 #if DEBUG_LOGS
-    qDebug() << "url:" << url << "title:" << title;
+    qDebug() << "url:" << url << "title:" << title << "transition:" << transition;
 #endif
 
     // Skip adding any urls with 'about:' prefix
     if (url.startsWith("about:")) {
         return Skipped;
     }
-    QSqlQuery query = prepare("SELECT 1 FROM browser_history WHERE url = ?;");
-
-    query.bindValue(0, url);
-    if (!execute(query)) {
+    if (urlId <= 0) {
         return Error;
     }
 
-    // Update history entry if it exists
-    if (query.first()) {
+    uint now = QDateTime::currentDateTimeUtc().toTime_t();
+    double score = visitScore(now, transition);
+    QSqlQuery query;
+
+    if (m_upsertSupported) {
+        // Adds the entry or counts the visit in one statement. An empty title
+        // leaves the title, and so the full text index, untouched.
         if (title.isEmpty()) {
-            query = prepare("UPDATE browser_history SET date = ?, visited_count = visited_count + 1  WHERE url = ?;");
-            query.bindValue(0, QDateTime::currentDateTimeUtc().toTime_t());
-            query.bindValue(1, url);
+            query = prepare("INSERT INTO browser_history (url_id, title, date, frecency) VALUES (?, ?, ?, ?) "
+                            "ON CONFLICT (url_id) DO UPDATE SET date = excluded.date, "
+                            "visited_count = visited_count + 1, frecency = frecency + excluded.frecency;");
+        } else {
+            query = prepare("INSERT INTO browser_history (url_id, title, date, frecency) VALUES (?, ?, ?, ?) "
+                            "ON CONFLICT (url_id) DO UPDATE SET date = excluded.date, title = excluded.title, "
+                            "visited_count = visited_count + 1, frecency = frecency + excluded.frecency;");
+        }
+        query.bindValue(0, urlId);
+        query.bindValue(1, title);
+        query.bindValue(2, now);
+        query.bindValue(3, score);
+        if (!execute(query)) {
+            return Error;
+        }
+    } else {
+        query = prepare("SELECT id FROM browser_history WHERE url_id = ?;");
+        query.bindValue(0, urlId);
+        if (!execute(query)) {
+            return Error;
+        }
+
+        // Update history entry if it exists
+        if (query.first()) {
+            int historyId = query.value(0).toInt();
+            if (title.isEmpty()) {
+                query = prepare("UPDATE browser_history SET date = ?, visited_count = visited_count + 1, frecency = frecency + ? WHERE id = ?;");
+                query.bindValue(0, now);
+                query.bindValue(1, score);
+                query.bindValue(2, historyId);
+            } else {
+                query = prepare("UPDATE browser_history SET date = ?, title = ?, visited_count = visited_count + 1, frecency = frecency + ? WHERE id = ?;");
+                query.bindValue(0, now);
+                query.bindValue(1, title);
+                query.bindValue(2, score);
+                query.bindValue(3, historyId);
+            }
         } else {
-            query = prepare("UPDATE browser_history SET date = ?, title = ?, visited_count = visited_count + 1  WHERE url = ?;");
-            query.bindValue(0, QDateTime::currentDateTimeUtc().toTime_t());
+            // Otherwise create a new history entry
+            query = prepare("INSERT INTO browser_history (url_id, title, date, frecency) VALUES (?, ?, ?, ?);");
+            query.bindValue(0, urlId);
             query.bindValue(1, title);
-            query.bindValue(2, url);
+            query.bindValue(2, now);
+            query.bindValue(3, score);
+        }
+        if (!execute(query)) {
+            return Error;
         }
-        return execute(query) ? Added : Error;
     }
 
-    // Otherwise create a new history entry
-    query = prepare("INSERT INTO browser_history (url, title, date) VALUES (?, ?, ?);");
-    query.bindValue(0, url);
-    query.bindValue(1, title);
-    query.bindValue(2, QDateTime::currentDateTimeUtc().toTime_t());
+    // History grows, check its limits once browsing pauses
+    m_expiryTimer.start(HISTORY_EXPIRY_DELAY);
+
+    query = prepare("INSERT INTO visits (history_id, date, transition) "
+                    "SELECT id, ?, ? FROM browser_history WHERE url_id = ?;");
+    query.bindValue(0, now);
+    query.bindValue(1, transition);
+    query.bindValue(2, urlId);
     return execute(query) ? Added : Error;
 }
 
 void DBWorker::clearHistory()
 {
+    m_batcher.addWrite();
     QSqlQuery query = prepare("DELETE FROM browser_history;");
     execute(query);
     removeAllTabs();
     query = prepare("DELETE FROM link;");
     execute(query);
+    releaseUrls();
 
-    QList<Link> linkList;
-    emit historyAvailable(linkList);
+    emit historyCleared();
 }
 
 int DBWorker::addToTabHistory(int tabId, int linkId)
@@ -521,10 +2136,55 @@ int DBWorker::addToTabHistory(int tabId, int linkId)
     return lastId.toInt();
 }
 
-int DBWorker::createLink(const QString &url, const QString &title, const QString &thumbPath)
+// 64-bit FNV-1a of the UTF-8 url. Stored in the url table, keep it stable.
+qint64 DBWorker::urlHash(const QString &url)
 {
-    QSqlQuery query = prepare("INSERT INTO link (url, title, thumb_path) VALUES (?, ?, ?);");
+    const QByteArray data = url.toUtf8();
+    quint64 hash = Q_UINT64_C(0xcbf29ce484222325);
+    for (int i = 0; i < data.size(); ++i) {
+        hash ^= static_cast<uchar>(data.at(i));
+        hash *= Q_UINT64_C(0x100000001b3);
+    }
+    return static_cast<qint64>(hash);
+}
+
+// Returns the id of url, adding it if needed. The index on the hash finds
+// the candidates, the url text is compared only for those.
+int DBWorker::internUrl(const QString &url)
+{
+    const qint64 hash = urlHash(url);
+    QSqlQuery query = prepare("SELECT id FROM url WHERE hash = ? AND url = ?;");
+    query.bindValue(0, hash);
+    query.bindValue(1, url);
+    if (!execute(query)) {
+        return 0;
+    }
+    if (query.first()) {
+        int urlId = query.value(0).toInt();
+        query.finish();
+        return urlId;
+    }
+
+    query = prepare("INSERT INTO url (url, hash) VALUES (?, ?);");
     query.bindValue(0, url);
+    query.bindValue(1, hash);
+    if (!execute(query)) {
+        return 0;
+    }
+    return query.lastInsertId().toInt();
+}
+
+// Drops urls that are no longer referenced by links or history
+void DBWorker::releaseUrls()
+{
+    QSqlQuery query = prepare("DELETE FROM url WHERE refcount <= 0;");
+    execute(query);
+}
+
+int DBWorker::createLink(int urlId, const QString &title, const QString &thumbPath)
+{
+    QSqlQuery query = prepare("INSERT INTO link (url_id, title, thumb_path) VALUES (?, ?, ?);");
+    query.bindValue(0, urlId);
     query.bindValue(1, title);
     query.bindValue(2, thumbPath);
     execute(query);
@@ -536,40 +2196,132 @@ int DBWorker::createLink(const QString &url, const QString &title, const QString
     }
 
 #if DEBUG_LOGS
-    qDebug() << title << url << thumbPath << lastId.toInt();
+    qDebug() << title << urlId << thumbPath << lastId.toInt();
 #endif
     int linkId = lastId.toInt();
     return linkId;
 }
 
-void DBWorker::getHistory(const QString &filter)
+// Searches of an older generation than the latest one are skipped. A search
+// that gets superseded while running is interrupted and gives no result.
+void DBWorker::getHistory(const QString &filter, int generation)
+{
+    m_runningSearch = generation;
+    if (searchSuperseded()) {
+        m_runningSearch = 0;
+        return;
+    }
+
+    // Without the handle a superseded search runs to its end
+    sqlite3 *handle = generation && m_sqliteLinked ? sqliteHandle(m_database) : 0;
+    if (handle) {
+        sqlite3_progress_handler(handle, SEARCH_PROGRESS_STEPS, &DBWorker::searchProgress, this);
+    }
+
+    bool ok = false;
+    QList<Link> linkList = queryHistory(filter, 0, 0, &ok);
+
+    if (handle) {
+        sqlite3_progress_handler(handle, 0, 0, 0);
+    }
+
+    // Stepping through the rows can be cut short without an error
+    bool superseded = searchSuperseded();
+    m_runningSearch = 0;
+    if (ok && !superseded) {
+        emit historyAvailable(linkList, generation);
+    }
+#if DEBUG_LOGS
+    if (superseded) {
+        qDebug() << "search" << generation << "superseded";
+    }
+#endif
+}
+
+bool DBWorker::searchSuperseded() const
+{
+    return m_runningSearch && m_searchGeneration && m_searchGeneration->load() != m_runningSearch;
+}
+
+// Progress handler of SQLite, a non-zero return interrupts the statement
+int DBWorker::searchProgress(void *worker)
+{
+    return static_cast<DBWorker *>(worker)->searchSuperseded() ? 1 : 0;
+}
+
+void DBWorker::getMoreHistory(const QString &filter, int afterLinkId, double afterSortKey)
+{
+    bool ok = false;
+    QList<Link> linkList = queryHistory(filter, afterLinkId, afterSortKey, &ok);
+    if (ok) {
+        emit moreHistoryAvailable(filter, afterLinkId, linkList);
+    }
+}
+
+// Returns one page of history. Pages are continued after the sort key and id
+// of the last row the caller has (keyset pagination), so fetching further pages
+// costs the same as the first one no matter how far the history has been
+// scrolled. The row itself may have been expired or removed meanwhile.
+QList<Link> DBWorker::queryHistory(const QString &filter, int afterLinkId, double afterSortKey, bool *ok)
 {
     // Skip empty titles always
-    QString filterQuery("WHERE (NULLIF(title, '') IS NOT NULL AND url NOT LIKE 'about:%' AND %1) ");
-    QString order;
+    QString filterQuery("WHERE (NULLIF(browser_history.title, '') IS NOT NULL AND url.url NOT LIKE 'about:%' AND %1) ");
+    QString sortKey;
+    QString search;
+    SearchCache::Mode mode = SearchCache::Substring;
+
+    if (!filter.isEmpty() && m_fullTextSearch != NoFullTextSearch) {
+        search = fullTextQuery(filter);
+    }
 
-    if (!filter.isEmpty()) {
-        filterQuery = filterQuery.arg(QString("(url LIKE :search OR title LIKE :search)"));
-        order = QString("date DESC, visited_count DESC, LENGTH(url), title");
+    if (!search.isEmpty()) {
+        // Only the matching rows get sorted
+        filterQuery = filterQuery.arg(QString("browser_history.id IN (SELECT rowid FROM browser_history_fts WHERE browser_history_fts MATCH :search)"));
+        sortKey = QString("browser_history.frecency");
+        mode = SearchCache::FullText;
+    } else if (!filter.isEmpty()) {
+        search = QString("%%1%").arg(filter);
+        filterQuery = filterQuery.arg(QString("(url.url LIKE :search OR browser_history.title LIKE :search)"));
+        sortKey = QString("browser_history.frecency");
     } else {
         filterQuery = filterQuery.arg(1);
-        order = QString("date DESC");
+        sortKey = QString("browser_history.date");
     }
 
-    QString queryString = QString("SELECT id, url, title, date, visited_count "
+    const bool cached = m_searchCache && afterLinkId == 0 && !filter.isEmpty();
+    QList<Link> linkList;
+    if (cached) {
+        // Changes whenever the writer has committed something
+        m_searchCache->setDataVersion(integerQuery("PRAGMA data_version;"));
+        if (m_searchCache->lookup(filter, mode, HISTORY_PAGE_SIZE, &linkList)) {
+            *ok = true;
+            return linkList;
+        }
+    }
+
+    if (afterLinkId > 0) {
+        filterQuery += QString("AND (%1, browser_history.id) < (:afterKey, :after) ").arg(sortKey);
+    }
+
+    QString queryString = QString("SELECT browser_history.id, url.url, browser_history.title, browser_history.date, browser_history.visited_count, %2 "
                                   "FROM browser_history "
+                                  "INNER JOIN url ON url.id = browser_history.url_id "
                                   "%1"
-                                  "ORDER BY %2 LIMIT 20;").arg(filterQuery).arg(order);
+                                  "ORDER BY %2 DESC, browser_history.id DESC LIMIT " STR(HISTORY_PAGE_SIZE) ";").arg(filterQuery).arg(sortKey);
     QSqlQuery query = prepare(queryString);
-    if (!filter.isEmpty()) {
-        query.bindValue(QString(":search"), QString("%%1%").arg(filter));
+    if (!search.isEmpty()) {
+        query.bindValue(QString(":search"), search);
+    }
+    if (afterLinkId > 0) {
+        query.bindValue(QString(":afterKey"), afterSortKey);
+        query.bindValue(QString(":after"), afterLinkId);
     }
 
-    if (!execute(query)) {
-        return;
+    *ok = execute(query);
+    if (!*ok) {
+        return linkList;
     }
 
-    QList<Link> linkList;
     while (query.next()) {
         qint64 timestamp = query.value(3).toLongLong();
         Link link(query.value(0).toInt(),
@@ -577,40 +2329,36 @@ void DBWorker::getHistory(const QString &filter)
                   "",
                   query.value(2).toString(),
                   QDateTime::fromMSecsSinceEpoch(timestamp*1000).date());
+        link.setSortKey(query.value(5).toDouble());
 #if DEBUG_LOGS
         qDebug() << &link << "visitedCount:" << query.value(4).toInt();
 #endif
         linkList.append(link);
     }
+    query.finish();
+
+    // An interrupted search may have stopped before the last row
+    if (cached && !searchSuperseded()) {
+        m_searchCache->insert(filter, mode, linkList, linkList.count() < HISTORY_PAGE_SIZE);
+    }
 
-    emit historyAvailable(linkList);
+    return linkList;
 }
 
 void DBWorker::getTabHistory(int tabId)
 {
-    QSqlQuery query = prepare("SELECT link.link_id, link.url, link.thumb_path, link.title, (tab_history.id == tab.tab_history_id) AS current "
-                              "FROM tab_history "
-                              "INNER JOIN tab ON tab.tab_id = tab_history.tab_id "
-                              "INNER JOIN link ON tab_history.link_id = link.link_id "
-                              "WHERE tab_history.tab_id = ? "
-                              "ORDER BY tab_history.id DESC;");
-    query.bindValue(0, tabId);
-    if (!execute(query)) {
-        return;
-    }
+    runBackgroundTasks();
 
     QList<Link> linkList;
     int currentLinkId(-1);
-    while (query.next()) {
-        int linkId = query.value(0).toInt();
-        Link tmp(linkId,
-                query.value(1).toString(),
-                query.value(2).toString(),
-                query.value(3).toString());
-        linkList.append(tmp);
-        if (query.value(4).toBool()) {
-            currentLinkId = linkId;
-        }
+
+    // Newest entry first
+    const TabHistory tabHistory = m_tabHistories.value(tabId);
+    for (int i = tabHistory.entries.count() - 1; i >= 0; --i) {
+        linkList.append(tabHistory.entries.at(i).link);
+    }
+    if (tabHistory.current >= 0) {
+        currentLinkId = tabHistory.entries.at(tabHistory.current).link.linkId();
     }
 
     emit tabHistoryAvailable(tabId, linkList, currentLinkId);
@@ -618,43 +2366,51 @@ void DBWorker::getTabHistory(int tabId)
 
 void DBWorker::removeHistoryEntry(int linkId)
 {
+    m_batcher.addWrite();
     QSqlQuery query = prepare("DELETE FROM browser_history WHERE id = ?");
     query.bindValue(0, linkId);
-    execute(query);
+    if (execute(query)) {
+        releaseUrls();
+    }
 }
 
 void DBWorker::updateThumbPath(int tabId, const QString &path)
 {
-    m_updateThumbPathQuery.bindValue(0, path);
-    m_updateThumbPathQuery.bindValue(1, tabId);
-    if (execute(m_updateThumbPathQuery)) {
+    m_batcher.addWrite();
+    QSqlQuery query = prepare("UPDATE link SET thumb_path = ? "
+                              "WHERE link_id IN (SELECT link.link_id "
+                              "FROM tab_history INNER JOIN link ON tab_history.link_id=link.link_id WHERE tab_history.tab_id = ?);");
+    query.bindValue(0, path);
+    query.bindValue(1, tabId);
+    if (execute(query)) {
+        QHash<int, TabHistory>::iterator tabHistory = m_tabHistories.find(tabId);
+        if (tabHistory != m_tabHistories.end()) {
+            for (int i = 0; i < tabHistory->entries.count(); ++i) {
+                tabHistory->entries[i].link.setThumbPath(path);
+            }
+        }
         emit thumbPathChanged(tabId, path);
     }
 }
 
 void DBWorker::updateTitle(int tabId, const QString &url, const QString &title)
 {
-    // TODO: add DB indices
-    QSqlQuery query = prepare("SELECT link.link_id, link.url, link.title FROM tab "
-                              "INNER JOIN tab_history ON tab.tab_history_id = tab_history.id "
-                              "INNER JOIN link ON tab_history.link_id = link.link_id "
-                              "WHERE tab_history.tab_id = ?;");
-    query.bindValue(0, tabId);
-    if (!execute(query)) {
-        qWarning() << "No link found for tabId" << tabId;
-        return;
+    m_batcher.addWrite();
+    // Navigation made after the call may have run first, the link is the
+    // latest one of the url up to the current entry.
+    QHash<int, TabHistory>::iterator tabHistory = m_tabHistories.find(tabId);
+    int index = tabHistory != m_tabHistories.end() ? tabHistory->current : -1;
+    while (index >= 0 && tabHistory->entries.at(index).link.url() != url) {
+        --index;
     }
-
-    if (query.first()) {
-        int linkId = query.value(0).toInt();
-        QString oldUrl = query.value(1).toString();
-        QString oldTitle = query.value(2).toString();
-
-        if (linkId > 0 && oldUrl.length() > 0 && oldTitle != title) {
-            query = prepare("UPDATE link SET title = ? WHERE link_id = ?;");
+    if (index >= 0) {
+        Link &link = tabHistory->entries[index].link;
+        if (link.linkId() > 0 && link.url().length() > 0 && link.title() != title) {
+            QSqlQuery query = prepare("UPDATE link SET title = ? WHERE link_id = ?;");
             query.bindValue(0, title);
-            query.bindValue(1, linkId);
+            query.bindValue(1, link.linkId());
             if (execute(query)) {
+                link.setTitle(title);
                 // For browsing history
                 emit titleChanged(url, title);
             } else {
@@ -663,9 +2419,10 @@ void DBWorker::updateTitle(int tabId, const QString &url, const QString &title)
         }
     }
 
-    query = prepare("UPDATE browser_history SET title = ? WHERE url = ?;");
+    QSqlQuery query = prepare("UPDATE browser_history SET title = ? WHERE url_id = (SELECT id FROM url WHERE hash = ? AND url = ?);");
     query.bindValue(0, title);
-    query.bindValue(1, url);
+    query.bindValue(1, urlHash(url));
+    query.bindValue(2, url);
     if (!execute(query)) {
         qWarning() << "Failed to add title to browser history";
     }
@@ -673,23 +2430,26 @@ void DBWorker::updateTitle(int tabId, const QString &url, const QString &title)
 
 void DBWorker::saveSetting(const QString &name, const QString &value)
 {
-    QSqlQuery query = prepare("SELECT value FROM settings WHERE name = ?;");
+    m_batcher.addWrite();
+    // The name is the primary key, replacing the row updates the value.
+    QSqlQuery query = prepare("INSERT OR REPLACE INTO settings (name, value) VALUES (?, ?);");
     query.bindValue(0, name);
-    if (!execute(query)) {
-        return;
-    }
-    if (query.first()) {
-        query = prepare("UPDATE settings SET value = ? WHERE name = ?;");
-        query.bindValue(0, value);
-        query.bindValue(1, name);
-    } else {
-        query = prepare("INSERT INTO settings (name, value) VALUES (?, ?);");
-        query.bindValue(0, name);
-        query.bindValue(1, value);
-    }
+    query.bindValue(1, value);
     execute(query);
 }
 
+// Null values delete the setting
+void DBWorker::saveSettings(const SettingsMap &settings)
+{
+    for (SettingsMap::const_iterator it = settings.constBegin(); it != settings.constEnd(); ++it) {
+        if (it.value().isNull()) {
+            deleteSetting(it.key());
+        } else {
+            saveSetting(it.key(), it.value());
+        }
+    }
+}
+
 SettingsMap DBWorker::getSettings()
 {
     QSqlQuery query = prepare("SELECT name,value FROM settings;");
@@ -704,6 +2464,7 @@ SettingsMap DBWorker::getSettings()
 
 void DBWorker::deleteSetting(const QString &name)
 {
+    m_batcher.addWrite();
     QSqlQuery query = prepare("DELETE FROM settings WHERE name = ?");
     query.bindValue(0, name);
     execute(query);
@@ -13,12 +13,32 @@
 #define DBWORKER_H
 
 #include <QObject>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QEvent>
+#include <QHash>
 #include <QMap>
+#include <QMutex>
+#include <QQueue>
 #include <QSqlDatabase>
 #include <QSqlQuery>
+#include <QTimer>
+#include <QVariantMap>
+#include <functional>
 
+#include "historylimits.h"
 #include "link.h"
 #include "tab.h"
+#include "transactionbatcher.h"
+
+class SearchCache;
+class StatementProfiler;
+class WriteBarrier;
+struct sqlite3;
+struct sqlite3_backup;
+
+// Number of history entries fetched at a time
+#define HISTORY_PAGE_SIZE 20
 
 // Typedefs are necessary because of use of Q_RETURN_ARG, which does understand
 // comma-separated types
@@ -26,19 +46,73 @@ typedef QMap<QString, QString> SettingsMap;
 
 enum HistoryResult { Error, Added, Skipped };
 
+// How a visit to a history entry happened, stored in the visits table
+enum VisitTransition { VisitLink = 1, VisitNewTab = 2 };
+
+// Scheduling classes of the calls made through DBManager, highest first
+enum TaskPriority { UserVisiblePriority, BackgroundPriority };
+
+// Runs a function on the thread of DBWorker, see DBWorker::post(). The
+// sequence tells the call order across the classes.
+class DBTask : public QEvent
+{
+public:
+    explicit DBTask(const std::function<void()> &function,
+                    TaskPriority priority = UserVisiblePriority, quint64 sequence = 0);
+
+    void run();
+    TaskPriority priority() const;
+    quint64 sequence() const;
+
+    static QEvent::Type eventType();
+    static QEvent::Type backgroundEventType();
+
+private:
+    std::function<void()> m_function;
+    TaskPriority m_priority;
+    quint64 m_sequence;
+};
+
 class DBWorker : public QObject
 {
     Q_OBJECT
 
 public:
     DBWorker(QObject *parent = 0);
+    ~DBWorker();
+
+    void setStatementCacheEnabled(bool enabled);
+    void setHistoryLimits(int maxEntries, qint64 maxBytes);
+    void setMaintenanceAllowed(bool allowed);
+
+    static qint64 urlHash(const QString &url);
+
+    // Coordination between the writer and the reader instance
+    void setWriteBarrier(WriteBarrier *barrier);
+    void setStatementProfiler(StatementProfiler *profiler);
+    void setSearchGeneration(const QAtomicInt *generation);
+    void setSearchCache(SearchCache *cache);
+    void post(DBTask *task);
+    void finishWrite(quint64 sequence);
+    void beginRead(quint64 sequence);
+    void endRead();
 
 public slots:
     void init();
+    void initReader();
+    void flush();
+    void runBackgroundTasks();
+    void checkpoint();
+    void expireHistory();
+    void collectLinks();
+    void maintain();
+    void backup(const QString &path);
+    void getStatistics();
     void createTab(const Tab &tab);
     void removeTab(int tabId);
     void getAllTabs();
     void removeAllTabs(bool noFeedback = false);
+    void saveSession(const QList<Tab> &tabs, int activeTabId);
     void navigateTo(int tabId, const QString &url, const QString &title, const QString &path);
     int getMaxTabId();
 
@@ -47,40 +121,163 @@ public slots:
 
     void goForward(int tabId);
     void goBack(int tabId);
-    void getHistory(const QString &filter);
+    void getHistory(const QString &filter, int generation = 0);
+    void getMoreHistory(const QString &filter, int afterLinkId, double afterSortKey);
     void getTabHistory(int tabId);
 
     void removeHistoryEntry(int linkId);
     void clearHistory();
 
     void saveSetting(const QString &name, const QString &value);
+    void saveSettings(const SettingsMap &settings);
     SettingsMap getSettings();
     void deleteSetting(const QString &name);
 
+protected:
+    bool event(QEvent *event);
+
 signals:
     void tabsAvailable(QList<Tab> tabs);
     void thumbPathChanged(int tabId, const QString &path);
     void titleChanged(const QString &url, const QString &title);
     void tabHistoryAvailable(int tabId, QList<Link>, int currentLinkId);
-    void historyAvailable(QList<Link>);
+    void historyAvailable(QList<Link>, int generation);
+    void historyCleared();
+    void moreHistoryAvailable(const QString &filter, int afterLinkId, QList<Link>);
     void error(const QString &query);
+    void statisticsAvailable(const QVariantMap &statistics);
+    void backupFinished(const QString &path, bool ok);
+
+private slots:
+    void publishWrites();
+    void backupStep();
 
 private:
-    HistoryResult addToBrowserHistory(const QString &url, const QString &title);
+    enum FullTextSearch { NoFullTextSearch, Fts4, Fts5 };
+    // Maintenance steps in the order they are run
+    enum MaintenanceStep { AnalyzeStep, VacuumStep, CheckpointStep, MaintenanceDone };
+
+    // Row of tab_history with its link
+    struct TabHistoryEntry {
+        TabHistoryEntry(int historyId = 0, const Link &link = Link())
+            : historyId(historyId), link(link) {}
+        int historyId;
+        Link link;
+    };
+
+    // History of a tab, oldest entry first
+    struct TabHistory {
+        TabHistory() : current(-1) {}
+        QList<TabHistoryEntry> entries;
+        int current;
+    };
+
+    HistoryResult addToBrowserHistory(const QString &url, int urlId, const QString &title, VisitTransition transition);
     int addToTabHistory(int tabId, int linkId);
+    QList<Link> queryHistory(const QString &filter, int afterLinkId, double afterSortKey, bool *ok);
+    bool searchSuperseded() const;
+    static int searchProgress(void *worker);
     Link getCurrentLink(int tabId);
     void clearDeprecatedTabHistory(int tabId, int currentLinkId);
-    int createLink(const QString &url, const QString &title = QString(), const QString &thumbPath = QString());
+    void appendTabHistory(int tabId, int historyId, const Link &link);
+    void moveInTabHistory(int tabId, int offset);
+    void loadTabHistories();
+    DBTask *takeBackgroundTask(quint64 before);
+    bool deferBackgroundWork(QTimer *timer, int interval);
+    qint64 historyBytes();
+    bool runMaintenanceStep(const QElapsedTimer &timer);
+    void finishBackup(bool ok);
+    int internUrl(const QString &url);
+    void releaseUrls();
+    int createLink(int urlId, const QString &title = QString(), const QString &thumbPath = QString());
     void updateTab(int tabId, int tabHistoryId);
     int tabCount();
     int integerQuery(const QString &statement);
-    void migrateTo_1();
+    QString textQuery(const QString &statement);
+    void configureDatabase();
+    void enableIncrementalVacuum();
+    void detectSqliteLibrary();
+    void detectFullTextSearch();
+    void migrate();
+    bool migrateTo_1();
+    bool migrateTo_2();
+    bool migrateTo_3();
+    bool migrateTo_4();
+    bool migrateTo_5();
+    bool migrateTo_6();
+    bool migrateTo_7();
     void setUserVersion(int userVersion);
 
     QSqlQuery prepare(const QString &statement);
     bool execute(QSqlQuery &query);
+    void clearStatementCache();
+    void resetStatementCache();
+
+    static QString databasePath();
+
     QSqlDatabase m_database;
-    QSqlQuery m_updateThumbPathQuery;
+    TransactionBatcher m_batcher;
+    WriteBarrier *m_writeBarrier;
+    StatementProfiler *m_profiler;
+    // Generation of the latest search requested and of the one running
+    const QAtomicInt *m_searchGeneration;
+    int m_runningSearch;
+    SearchCache *m_searchCache;
+    quint64 m_writeSequence;
+    // Background tasks wait here until nothing else is queued, or until a
+    // call made after them needs their results
+    QMutex m_backgroundMutex;
+    QQueue<DBTask *> m_backgroundTasks;
+    // Tasks of the higher classes posted and not run yet
+    QAtomicInt m_pendingTasks;
+    // Sequence of the task running, zero outside of tasks
+    quint64 m_runningSequence;
+    int m_foregroundTaskCount;
+    int m_backgroundTaskCount;
+    int m_promotedTaskCount;
+    int m_deferredWorkCount;
+    int m_maxBackgroundQueue;
+    qint64 m_backgroundTime;
+    QTimer m_checkpointTimer;
+    QTimer m_expiryTimer;
+    int m_historyMaxEntries;
+    qint64 m_historyMaxBytes;
+    bool m_dbstatSupported;
+    int m_expiredEntries;
+    int m_expiryBatches;
+    QTimer m_linkCollectionTimer;
+    int m_collectedLinks;
+    QTimer m_maintenanceTimer;
+    QAtomicInt m_maintenanceAllowed;
+    MaintenanceStep m_maintenanceStep;
+    QElapsedTimer m_lastMaintenance;
+    int m_maintenanceRuns;
+    qint64 m_maintenanceTime;
+    qint64 m_reclaimedBytes;
+    // Online backup in progress, written to a temporary file next to m_backupPath
+    sqlite3 *m_backupDatabase;
+    sqlite3_backup *m_backup;
+    QString m_backupPath;
+    QTimer m_backupTimer;
+    int m_backupCount;
+    int m_failedBackups;
+    bool m_walEnabled;
+    int m_checkpointCount;
+    int m_checkpointedPages;
+    FullTextSearch m_fullTextSearch;
+    // INSERT ... ON CONFLICT DO UPDATE, SQLite 3.24 and later
+    bool m_upsertSupported;
+    // The Qt driver runs on the SQLite library linked here
+    bool m_sqliteLinked;
+
+    // Authoritative copy of the tab histories, only used by the writer
+    QHash<int, TabHistory> m_tabHistories;
+
+    // Prepared statements keyed by their SQL text
+    QHash<QString, QSqlQuery> m_statementCache;
+    bool m_statementCacheEnabled;
+    int m_statementCacheHits;
+    int m_statementCacheMisses;
 };
 
 #endif // DBWORKER_H
@@ -0,0 +1,20 @@
+/****************************************************************************
+**
+** Copyright (c) 2026 Jolla Ltd.
+**
+****************************************************************************/
+
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef HISTORYLIMITS_H
+#define HISTORYLIMITS_H
+
+// Default limits for the browser history, see DBManager::setHistoryLimits().
+// The byte budget applies to the storage taken by the history only, tabs
+// and their navigation history do not count.
+#define DEFAULT_HISTORY_MAX_ENTRIES 2000
+#define DEFAULT_HISTORY_MAX_BYTES (16 * 1024 * 1024)
+
+#endif // HISTORYLIMITS_H
@@ -13,12 +13,12 @@
 #include <QDebug>
 
 Link::Link(int linkId, const QString &urlString, const QString &thumbPath, const QString &title, const QDate &date) :
-    m_linkId(linkId), m_url(urlString), m_thumbPath(thumbPath), m_title(title), m_date(date)
+    m_linkId(linkId), m_url(urlString), m_thumbPath(thumbPath), m_title(title), m_date(date), m_sortKey(0)
 {
 }
 
 Link::Link() :
-    m_linkId(0), m_url(""), m_thumbPath(""), m_title(""), m_date(QDate())
+    m_linkId(0), m_url(""), m_thumbPath(""), m_title(""), m_date(QDate()), m_sortKey(0)
 {
 }
 
@@ -27,7 +27,8 @@ Link::Link(const Link& l) :
     m_url(l.m_url),
     m_thumbPath(l.m_thumbPath),
     m_title(l.m_title),
-    m_date(l.m_date)
+    m_date(l.m_date),
+    m_sortKey(l.m_sortKey)
 {
 }
 
@@ -100,6 +101,16 @@ void Link::setDate(const QDate &date)
     m_date = date;
 }
 
+double Link::sortKey() const
+{
+    return m_sortKey;
+}
+
+void Link::setSortKey(double sortKey)
+{
+    m_sortKey = sortKey;
+}
+
 QDebug operator<<(QDebug dbg, const Link *link) {
     if (!link) {
         return dbg << "Link (this = 0x0)";
@@ -43,12 +43,18 @@ public:
     QDate date() const;
     void setDate(const QDate &date);
 
+    // Position in the history list the link was queried for, see
+    // DBWorker::queryHistory()
+    double sortKey() const;
+    void setSortKey(double sortKey);
+
 private:
     int m_linkId;
     QString m_url;
     QString m_thumbPath;
     QString m_title;
     QDate m_date;
+    double m_sortKey;
 };
 
 QDebug operator<<(QDebug, const Link *);
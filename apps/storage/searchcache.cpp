@@ -0,0 +1,188 @@
+/****************************************************************************
+**
+** Copyright (c) 2026 Jolla Ltd.
+**
+****************************************************************************/
+
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <QRegularExpression>
+#include <QStringList>
+
+#include "searchcache.h"
+
+static bool isAscii(const QString &text)
+{
+    for (int i = 0; i < text.length(); ++i) {
+        if (text.at(i).unicode() > 0x7f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+SearchCache::SearchCache()
+    : m_dataVersion(-1)
+    , m_hits(0)
+    , m_refinements(0)
+    , m_misses(0)
+    , m_invalidations(0)
+{
+}
+
+// Drops the cached results if the database has changed since they were cached
+void SearchCache::setDataVersion(qint64 dataVersion)
+{
+    if (dataVersion == m_dataVersion) {
+        return;
+    }
+
+    if (!m_entries.isEmpty()) {
+        m_invalidations.ref();
+        m_entries.clear();
+    }
+    m_dataVersion = dataVersion;
+}
+
+// Returns true if the first page of results for filter could be served from
+// the cache. Refined results are cached as well.
+bool SearchCache::lookup(const QString &filter, Mode mode, int pageSize, QList<Link> *links)
+{
+    if (filter.isEmpty()) {
+        return false;
+    }
+
+    int best = -1;
+    for (int i = 0; i < m_entries.count(); ++i) {
+        const Entry &entry = m_entries.at(i);
+        if (entry.mode == mode && filter.startsWith(entry.filter)
+                && (best < 0 || entry.filter.length() > m_entries.at(best).filter.length())) {
+            best = i;
+        }
+    }
+
+    if (best >= 0) {
+        const Entry entry = m_entries.takeAt(best);
+        m_entries.prepend(entry);
+
+        if (entry.filter == filter) {
+            *links = entry.links;
+            m_hits.ref();
+            return true;
+        }
+
+        if (narrow(entry, filter, pageSize, links)) {
+            insert(filter, mode, *links, entry.complete);
+            m_hits.ref();
+            m_refinements.ref();
+            return true;
+        }
+    }
+
+    m_misses.ref();
+    return false;
+}
+
+// complete tells whether links holds all matches of filter
+void SearchCache::insert(const QString &filter, Mode mode, const QList<Link> &links, bool complete)
+{
+    if (filter.isEmpty()) {
+        return;
+    }
+
+    for (int i = 0; i < m_entries.count(); ++i) {
+        if (m_entries.at(i).filter == filter && m_entries.at(i).mode == mode) {
+            m_entries.removeAt(i);
+            break;
+        }
+    }
+
+    Entry entry;
+    entry.filter = filter;
+    entry.mode = mode;
+    entry.links = links;
+    entry.complete = complete;
+    m_entries.prepend(entry);
+
+    while (m_entries.count() > SEARCH_CACHE_SIZE) {
+        m_entries.removeLast();
+    }
+}
+
+void SearchCache::clear()
+{
+    m_entries.clear();
+}
+
+QVariantMap SearchCache::statistics() const
+{
+    int hits = m_hits.load();
+    int misses = m_misses.load();
+
+    QVariantMap stats;
+    stats.insert(QStringLiteral("hits"), hits);
+    stats.insert(QStringLiteral("refinements"), m_refinements.load());
+    stats.insert(QStringLiteral("misses"), misses);
+    stats.insert(QStringLiteral("invalidations"), m_invalidations.load());
+    stats.insert(QStringLiteral("hitRate"), hits + misses > 0 ? double(hits) / (hits + misses) : 0.0);
+    return stats;
+}
+
+// Rows of entry matching filter, which extends the filter of entry. Fails if
+// the rows cannot be matched like SQLite would, or if the cached rows do not
+// cover the first page of filter.
+bool SearchCache::narrow(const Entry &entry, const QString &filter, int pageSize, QList<Link> *links)
+{
+    // SQLite folds the case of ASCII letters only, and % and _ are wildcards for LIKE
+    if (!isAscii(filter) || (entry.mode == Substring
+                             && (filter.contains(QLatin1Char('%')) || filter.contains(QLatin1Char('_'))))) {
+        return false;
+    }
+
+    QList<Link> narrowed;
+    foreach (const Link &link, entry.links) {
+        if (!isAscii(link.url()) || !isAscii(link.title())) {
+            return false;
+        }
+        if (matches(link, filter, entry.mode)) {
+            narrowed.append(link);
+        }
+    }
+
+    // Matches past the cached page would be missing
+    if (!entry.complete && narrowed.count() < pageSize) {
+        return false;
+    }
+
+    *links = narrowed.mid(0, pageSize);
+    return true;
+}
+
+// Same as the queries of DBWorker: LIKE '%filter%' on the url or the title,
+// or every word of filter being a prefix of a word in the url or the title.
+bool SearchCache::matches(const Link &link, const QString &filter, Mode mode)
+{
+    if (mode == Substring) {
+        return link.url().contains(filter, Qt::CaseInsensitive)
+                || link.title().contains(filter, Qt::CaseInsensitive);
+    }
+
+    // Tokenizers of SQLite split ASCII text at anything but letters and digits
+    static const QRegularExpression separator(QStringLiteral("[^a-z0-9]+"));
+    const QStringList words = (link.url() + QLatin1Char(' ') + link.title()).toLower().split(separator, QString::SkipEmptyParts);
+    foreach (const QString &term, filter.toLower().split(separator, QString::SkipEmptyParts)) {
+        bool found = false;
+        foreach (const QString &word, words) {
+            if (word.startsWith(term)) {
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,74 @@
+/****************************************************************************
+**
+** Copyright (c) 2026 Jolla Ltd.
+**
+****************************************************************************/
+
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef SEARCHCACHE_H
+#define SEARCHCACHE_H
+
+#include <QAtomicInt>
+#include <QList>
+#include <QString>
+#include <QVariantMap>
+
+#include "link.h"
+
+// Number of searches kept
+#define SEARCH_CACHE_SIZE 8
+
+/**
+ * Results of the latest history searches of the reader.
+ *
+ * While the user types, each filter extends the previous one and its matches
+ * are a subset of the previous matches in the same order. lookup() then
+ * narrows the cached rows of the longest cached prefix of the filter instead
+ * of running the query again. Narrowing reproduces the LIKE and full text
+ * matching of DBWorker for ASCII text; a cached search with other text is
+ * not narrowed.
+ *
+ * The cache is dropped whenever the database has changed, see
+ * setDataVersion(). Only the reader uses the cache, the statistics can be
+ * read from any thread.
+ */
+class SearchCache
+{
+public:
+    enum Mode { Substring, FullText };
+
+    SearchCache();
+
+    void setDataVersion(qint64 dataVersion);
+    bool lookup(const QString &filter, Mode mode, int pageSize, QList<Link> *links);
+    void insert(const QString &filter, Mode mode, const QList<Link> &links, bool complete);
+    void clear();
+
+    QVariantMap statistics() const;
+
+private:
+    struct Entry {
+        QString filter;
+        Mode mode;
+        QList<Link> links;
+        // All matches of the filter, not only the first page
+        bool complete;
+    };
+
+    static bool narrow(const Entry &entry, const QString &filter, int pageSize, QList<Link> *links);
+    static bool matches(const Link &link, const QString &filter, Mode mode);
+
+    // Most recently used first
+    QList<Entry> m_entries;
+    qint64 m_dataVersion;
+
+    QAtomicInt m_hits;
+    QAtomicInt m_refinements;
+    QAtomicInt m_misses;
+    QAtomicInt m_invalidations;
+};
+
+#endif // SEARCHCACHE_H
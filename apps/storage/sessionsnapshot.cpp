@@ -0,0 +1,172 @@
+/****************************************************************************
+**
+** Copyright (c) 2026 Jolla Ltd.
+**
+****************************************************************************/
+
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <QDataStream>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+
+#include "browserpaths.h"
+#include "sessionsnapshot.h"
+
+#ifndef DEBUG_LOGS
+#define DEBUG_LOGS 0
+#endif
+
+#define SNAPSHOT_NAME "session.snapshot"
+
+// "SBSS", sailfish-browser session snapshot
+static const quint32 SNAPSHOT_MAGIC = 0x53425353;
+// Bump when the payload layout changes, older snapshots are then ignored.
+static const quint16 SNAPSHOT_VERSION = 1;
+// magic, version, reserved, payload size and checksum
+static const int SNAPSHOT_HEADER_SIZE = 16;
+
+static quint32 crc32(const char *data, int length)
+{
+    quint32 crc = 0xffffffff;
+    for (int i = 0; i < length; ++i) {
+        crc ^= static_cast<uchar>(data[i]);
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+QString SessionSnapshot::path()
+{
+    QString dataDir = BrowserPaths::dataLocation();
+    if (dataDir.isNull()) {
+        return QString();
+    }
+    return QDir(dataDir).absoluteFilePath(QLatin1String(SNAPSHOT_NAME));
+}
+
+bool SessionSnapshot::load(QList<Tab> *tabs, int *activeTabId, const QString &fileName)
+{
+    if (fileName.isEmpty()) {
+        return false;
+    }
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    qint64 size = file.size();
+    if (size < SNAPSHOT_HEADER_SIZE) {
+        qWarning() << "Ignoring truncated session snapshot" << fileName;
+        return false;
+    }
+
+    uchar *mapped = file.map(0, size);
+    if (!mapped) {
+        qWarning() << "Failed to map session snapshot" << fileName << file.errorString();
+        return false;
+    }
+
+    // Wraps the mapping without copying it
+    QByteArray data = QByteArray::fromRawData(reinterpret_cast<const char *>(mapped), size);
+    QDataStream in(data);
+    in.setVersion(QDataStream::Qt_5_6);
+
+    quint32 magic;
+    quint16 version;
+    quint16 reserved;
+    quint32 payloadSize;
+    quint32 checksum;
+    in >> magic >> version >> reserved >> payloadSize >> checksum;
+
+    bool ok = false;
+    if (magic != SNAPSHOT_MAGIC || version != SNAPSHOT_VERSION) {
+        qWarning() << "Ignoring session snapshot of unknown format" << magic << version;
+    } else if (payloadSize != size - SNAPSHOT_HEADER_SIZE) {
+        qWarning() << "Ignoring session snapshot of wrong size" << size;
+    } else if (checksum != crc32(data.constData() + SNAPSHOT_HEADER_SIZE, payloadSize)) {
+        qWarning() << "Ignoring corrupted session snapshot" << fileName;
+    } else {
+        qint32 activeId;
+        quint32 count;
+        in >> activeId >> count;
+
+        QList<Tab> snapshotTabs;
+        for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+            qint32 tabId;
+            QString url;
+            QString title;
+            QString thumbPath;
+            in >> tabId >> url >> title >> thumbPath;
+            snapshotTabs.append(Tab(tabId, url, title, thumbPath));
+        }
+
+        if (in.status() == QDataStream::Ok && in.atEnd()) {
+            *tabs = snapshotTabs;
+            *activeTabId = activeId;
+            ok = true;
+        } else {
+            qWarning() << "Ignoring malformed session snapshot" << fileName;
+        }
+    }
+
+    // The strings read above are deep copies, the mapping can go.
+    file.unmap(mapped);
+
+#if DEBUG_LOGS
+    qDebug() << "loaded" << tabs->count() << "tabs from session snapshot, ok:" << ok;
+#endif
+
+    return ok;
+}
+
+bool SessionSnapshot::save(const QList<Tab> &tabs, int activeTabId, const QString &fileName)
+{
+    if (fileName.isEmpty()) {
+        return false;
+    }
+
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_6);
+    out << qint32(activeTabId) << quint32(tabs.count());
+    foreach (const Tab &tab, tabs) {
+        out << qint32(tab.tabId()) << tab.url() << tab.title() << tab.thumbnailPath();
+    }
+
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Failed to open session snapshot" << fileName << file.errorString();
+        return false;
+    }
+
+    QDataStream header(&file);
+    header.setVersion(QDataStream::Qt_5_6);
+    header << SNAPSHOT_MAGIC << SNAPSHOT_VERSION << quint16(0)
+           << quint32(payload.size()) << crc32(payload.constData(), payload.size());
+    file.write(payload);
+
+    // Renames the temporary file over the old snapshot
+    if (!file.commit()) {
+        qWarning() << "Failed to write session snapshot" << fileName << file.errorString();
+        return false;
+    }
+
+#if DEBUG_LOGS
+    qDebug() << "saved" << tabs.count() << "tabs to session snapshot";
+#endif
+
+    return true;
+}
+
+bool SessionSnapshot::remove(const QString &fileName)
+{
+    return fileName.isEmpty() || !QFile::exists(fileName) || QFile::remove(fileName);
+}
@@ -0,0 +1,42 @@
+/****************************************************************************
+**
+** Copyright (c) 2026 Jolla Ltd.
+**
+****************************************************************************/
+
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef SESSIONSNAPSHOT_H
+#define SESSIONSNAPSHOT_H
+
+#include <QList>
+#include <QString>
+
+#include "tab.h"
+
+/**
+ * Binary copy of the open tabs kept next to the database.
+ *
+ * The snapshot holds the tab list in model order, the active tab and the
+ * current url, title and thumbnail of each tab. It is small enough to be
+ * read synchronously at startup, before the database has been opened.
+ *
+ * The file starts with a fixed header: magic, format version, payload size
+ * and a CRC-32 of the payload. A snapshot of another version, of the wrong
+ * size or with a checksum mismatch is ignored. Saving writes a temporary
+ * file which is renamed over the old one, so readers see either the old or
+ * the new snapshot, never a partial one.
+ */
+class SessionSnapshot
+{
+public:
+    static QString path();
+
+    static bool load(QList<Tab> *tabs, int *activeTabId, const QString &fileName = path());
+    static bool save(const QList<Tab> &tabs, int activeTabId, const QString &fileName = path());
+    static bool remove(const QString &fileName = path());
+};
+
+#endif // SESSIONSNAPSHOT_H
@@ -0,0 +1,150 @@
+/****************************************************************************
+**
+** Copyright (c) 2026 Jolla Ltd.
+**
+****************************************************************************/
+
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <QDateTime>
+#include <QDebug>
+#include <QMutexLocker>
+#include <QVariantList>
+
+#include "statementprofiler.h"
+
+// Number of the latest slow statements kept for statistics()
+#define MAX_SLOW_QUERIES 50
+
+static int bucket(qint64 usecs)
+{
+    int bucket = 0;
+    while (usecs > 1 && bucket < PROFILE_BUCKET_COUNT - 1) {
+        usecs >>= 1;
+        ++bucket;
+    }
+    return bucket;
+}
+
+StatementProfiler::Profile::Profile()
+    : count(0)
+    , rows(0)
+    , totalTime(0)
+    , maxTime(0)
+{
+    for (int i = 0; i < PROFILE_BUCKET_COUNT; ++i) {
+        histogram[i] = 0;
+    }
+}
+
+StatementProfiler::StatementProfiler()
+    : m_enabled(0)
+    , m_slowQueryThreshold(DEFAULT_SLOW_QUERY_THRESHOLD)
+    , m_slowQueryCount(0)
+{
+}
+
+void StatementProfiler::setEnabled(bool enabled)
+{
+    m_enabled.store(enabled ? 1 : 0);
+}
+
+bool StatementProfiler::isEnabled() const
+{
+    return m_enabled.load();
+}
+
+// Executions taking at least msec milliseconds are logged
+void StatementProfiler::setSlowQueryThreshold(int msec)
+{
+    m_slowQueryThreshold.store(msec);
+}
+
+void StatementProfiler::record(const QString &statement, qint64 nsecs, int rows)
+{
+    qint64 usecs = nsecs / 1000;
+    bool slow = usecs >= qint64(m_slowQueryThreshold.load()) * 1000;
+    if (slow) {
+        qWarning() << "Slow query took" << usecs / 1000 << "ms:" << statement;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    Profile &profile = m_profiles[statement];
+    ++profile.count;
+    if (rows > 0) {
+        profile.rows += rows;
+    }
+    profile.totalTime += usecs;
+    profile.maxTime = qMax(profile.maxTime, usecs);
+    ++profile.histogram[bucket(usecs)];
+
+    if (slow) {
+        SlowQuery query;
+        query.statement = statement;
+        query.time = usecs;
+        query.timestamp = QDateTime::currentMSecsSinceEpoch();
+        m_slowQueries.append(query);
+        if (m_slowQueries.count() > MAX_SLOW_QUERIES) {
+            m_slowQueries.removeFirst();
+        }
+        ++m_slowQueryCount;
+    }
+}
+
+void StatementProfiler::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    m_profiles.clear();
+    m_slowQueries.clear();
+    m_slowQueryCount = 0;
+}
+
+// Times are in microseconds. Histograms list the non-empty buckets with the
+// exclusive upper bound of each.
+QVariantMap StatementProfiler::statistics() const
+{
+    QMutexLocker locker(&m_mutex);
+
+    QVariantList statements;
+    for (QHash<QString, Profile>::const_iterator it = m_profiles.constBegin(); it != m_profiles.constEnd(); ++it) {
+        const Profile &profile = it.value();
+        QVariantList histogram;
+        for (int i = 0; i < PROFILE_BUCKET_COUNT; ++i) {
+            if (profile.histogram[i] > 0) {
+                QVariantMap entry;
+                entry.insert(QStringLiteral("below"), i < PROFILE_BUCKET_COUNT - 1 ? qint64(2) << i : -1);
+                entry.insert(QStringLiteral("count"), profile.histogram[i]);
+                histogram.append(entry);
+            }
+        }
+
+        QVariantMap statement;
+        statement.insert(QStringLiteral("statement"), it.key());
+        statement.insert(QStringLiteral("count"), profile.count);
+        statement.insert(QStringLiteral("rows"), profile.rows);
+        statement.insert(QStringLiteral("totalTime"), profile.totalTime);
+        statement.insert(QStringLiteral("averageTime"), profile.totalTime / profile.count);
+        statement.insert(QStringLiteral("maxTime"), profile.maxTime);
+        statement.insert(QStringLiteral("histogram"), histogram);
+        statements.append(statement);
+    }
+
+    QVariantList slowQueries;
+    foreach (const SlowQuery &query, m_slowQueries) {
+        QVariantMap entry;
+        entry.insert(QStringLiteral("statement"), query.statement);
+        entry.insert(QStringLiteral("time"), query.time);
+        entry.insert(QStringLiteral("timestamp"), query.timestamp);
+        slowQueries.append(entry);
+    }
+
+    QVariantMap stats;
+    stats.insert(QStringLiteral("enabled"), isEnabled());
+    stats.insert(QStringLiteral("slowQueryThreshold"), m_slowQueryThreshold.load());
+    stats.insert(QStringLiteral("slowQueryCount"), m_slowQueryCount);
+    stats.insert(QStringLiteral("statements"), statements);
+    stats.insert(QStringLiteral("slowQueries"), slowQueries);
+    return stats;
+}
@@ -0,0 +1,77 @@
+/****************************************************************************
+**
+** Copyright (c) 2026 Jolla Ltd.
+**
+****************************************************************************/
+
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef STATEMENTPROFILER_H
+#define STATEMENTPROFILER_H
+
+#include <QAtomicInt>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QVariantMap>
+
+// Default for logging slow statements, in milliseconds
+#define DEFAULT_SLOW_QUERY_THRESHOLD 100
+
+// Number of latency buckets, bucket n counts executions taking less than
+// 2^(n + 1) microseconds. The last one also takes the slower ones.
+#define PROFILE_BUCKET_COUNT 24
+
+/**
+ * Collects execution times of the SQL statements of DBWorker.
+ *
+ * Statements are identified by their SQL text. For each one the profiler
+ * keeps the number of executions, a histogram of the latencies with power
+ * of two buckets and the number of rows changed. Executions slower than the
+ * threshold are logged and kept in a short list of slow queries.
+ *
+ * The writer and the reader share one profiler. It is disabled by default;
+ * then DBWorker only checks isEnabled() per statement.
+ */
+class StatementProfiler
+{
+public:
+    StatementProfiler();
+
+    void setEnabled(bool enabled);
+    bool isEnabled() const;
+    void setSlowQueryThreshold(int msec);
+
+    void record(const QString &statement, qint64 nsecs, int rows);
+    void clear();
+
+    QVariantMap statistics() const;
+
+private:
+    struct Profile {
+        Profile();
+        int count;
+        qint64 rows;
+        qint64 totalTime;
+        qint64 maxTime;
+        int histogram[PROFILE_BUCKET_COUNT];
+    };
+
+    struct SlowQuery {
+        QString statement;
+        qint64 time;
+        qint64 timestamp;
+    };
+
+    mutable QMutex m_mutex;
+    QAtomicInt m_enabled;
+    QAtomicInt m_slowQueryThreshold;
+    QHash<QString, Profile> m_profiles;
+    QList<SlowQuery> m_slowQueries;
+    int m_slowQueryCount;
+};
+
+#endif // STATEMENTPROFILER_H
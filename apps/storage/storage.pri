@@ -5,13 +5,27 @@ SOURCES += \
     $$PWD/dbmanager.cpp \
     $$PWD/dbworker.cpp \
     $$PWD/link.cpp \
-    $$PWD/tab.cpp
+    $$PWD/searchcache.cpp \
+    $$PWD/sessionsnapshot.cpp \
+    $$PWD/statementprofiler.cpp \
+    $$PWD/tab.cpp \
+    $$PWD/transactionbatcher.cpp \
+    $$PWD/writebarrier.cpp
 
 # C++ headers
 HEADERS += \
     $$PWD/dbmanager.h \
     $$PWD/dbworker.h \
+    $$PWD/historylimits.h \
     $$PWD/link.h \
-    $$PWD/tab.h
+    $$PWD/searchcache.h \
+    $$PWD/sessionsnapshot.h \
+    $$PWD/statementprofiler.h \
+    $$PWD/tab.h \
+    $$PWD/transactionbatcher.h \
+    $$PWD/writebarrier.h
 
 DEFINES += DB_NAME=\\\"sailfish-browser.sqlite\\\"
+
+CONFIG += link_pkgconfig
+PKGCONFIG += sqlite3
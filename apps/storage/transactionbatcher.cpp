@@ -0,0 +1,153 @@
+/****************************************************************************
+**
+** Copyright (c) 2026 Jolla Ltd.
+**
+****************************************************************************/
+
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QSqlError>
+
+#include "transactionbatcher.h"
+
+#ifndef DEBUG_LOGS
+#define DEBUG_LOGS 0
+#endif
+
+// Upper bound for how long a write may stay uncommitted, in milliseconds.
+#define DEFAULT_MAX_BATCH_LATENCY 100
+
+TransactionBatcher::TransactionBatcher(QObject *parent)
+    : QObject(parent)
+    , m_idleTimer(this)
+    , m_deadlineTimer(this)
+    , m_inTransaction(false)
+    , m_pendingWrites(0)
+    , m_batchCount(0)
+    , m_writeCount(0)
+    , m_maxBatchSize(0)
+    , m_lastBatchSize(0)
+    , m_failedCommits(0)
+    , m_totalCommitTime(0)
+    , m_maxCommitTime(0)
+    , m_lastCommitTime(0)
+{
+    // Zero timer fires once queued events of the current event loop turn
+    // have been processed.
+    m_idleTimer.setSingleShot(true);
+    m_idleTimer.setInterval(0);
+    m_deadlineTimer.setSingleShot(true);
+    m_deadlineTimer.setInterval(DEFAULT_MAX_BATCH_LATENCY);
+
+    connect(&m_idleTimer, &QTimer::timeout, this, &TransactionBatcher::commit);
+    connect(&m_deadlineTimer, &QTimer::timeout, this, &TransactionBatcher::commit);
+}
+
+void TransactionBatcher::setDatabase(const QSqlDatabase &database)
+{
+    flush();
+    m_database = database;
+}
+
+void TransactionBatcher::setMaxLatency(int msec)
+{
+    m_deadlineTimer.setInterval(msec);
+}
+
+void TransactionBatcher::addWrite()
+{
+    if (!m_database.isOpen()) {
+        return;
+    }
+
+    if (!m_inTransaction) {
+        if (!m_database.transaction()) {
+            qWarning() << Q_FUNC_INFO << "failed to begin transaction" << m_database.lastError();
+            return;
+        }
+        m_inTransaction = true;
+        m_deadlineTimer.start();
+    }
+
+    ++m_pendingWrites;
+    // Each write postpones the commit until the event queue has drained,
+    // the deadline timer keeps a steady stream of writes from starving it.
+    m_idleTimer.start();
+}
+
+bool TransactionBatcher::flush()
+{
+    if (!m_inTransaction) {
+        return true;
+    }
+
+    int failedCommits = m_failedCommits;
+    commit();
+    return failedCommits == m_failedCommits;
+}
+
+bool TransactionBatcher::inTransaction() const
+{
+    return m_inTransaction;
+}
+
+void TransactionBatcher::commit()
+{
+    m_idleTimer.stop();
+    m_deadlineTimer.stop();
+
+    if (!m_inTransaction) {
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    bool ok = m_database.commit();
+    qint64 elapsed = timer.nsecsElapsed() / 1000;
+    m_inTransaction = false;
+
+    if (!ok) {
+        qWarning() << Q_FUNC_INFO << "failed to commit" << m_pendingWrites << "writes" << m_database.lastError();
+        m_database.rollback();
+        ++m_failedCommits;
+        m_pendingWrites = 0;
+        emit rolledBack();
+        return;
+    }
+
+#if DEBUG_LOGS
+    qDebug() << "committed" << m_pendingWrites << "writes in" << elapsed << "us";
+#endif
+
+    ++m_batchCount;
+    m_writeCount += m_pendingWrites;
+    m_lastBatchSize = m_pendingWrites;
+    m_maxBatchSize = qMax(m_maxBatchSize, m_pendingWrites);
+    m_totalCommitTime += elapsed;
+    m_lastCommitTime = elapsed;
+    m_maxCommitTime = qMax(m_maxCommitTime, elapsed);
+    m_pendingWrites = 0;
+
+    emit committed();
+}
+
+QVariantMap TransactionBatcher::statistics() const
+{
+    QVariantMap stats;
+    stats.insert(QStringLiteral("batchCount"), m_batchCount);
+    stats.insert(QStringLiteral("writeCount"), m_writeCount);
+    stats.insert(QStringLiteral("pendingWrites"), m_pendingWrites);
+    stats.insert(QStringLiteral("lastBatchSize"), m_lastBatchSize);
+    stats.insert(QStringLiteral("maxBatchSize"), m_maxBatchSize);
+    stats.insert(QStringLiteral("averageBatchSize"), m_batchCount > 0 ? qreal(m_writeCount) / m_batchCount : 0.0);
+    stats.insert(QStringLiteral("failedCommits"), m_failedCommits);
+    // Commit latencies are in microseconds
+    stats.insert(QStringLiteral("lastCommitTime"), m_lastCommitTime);
+    stats.insert(QStringLiteral("maxCommitTime"), m_maxCommitTime);
+    stats.insert(QStringLiteral("averageCommitTime"), m_batchCount > 0 ? m_totalCommitTime / m_batchCount : 0);
+    return stats;
+}
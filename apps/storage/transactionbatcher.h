@@ -0,0 +1,68 @@
+/****************************************************************************
+**
+** Copyright (c) 2026 Jolla Ltd.
+**
+****************************************************************************/
+
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef TRANSACTIONBATCHER_H
+#define TRANSACTIONBATCHER_H
+
+#include <QObject>
+#include <QSqlDatabase>
+#include <QTimer>
+#include <QVariantMap>
+
+/**
+ * Groups the writes of DBWorker into a single SQLite transaction.
+ *
+ * The first write opens a transaction which stays open until the worker
+ * thread's event loop runs out of queued work, or until the maximum batch
+ * latency has passed. Thus a burst of writes costs one commit (one fsync)
+ * instead of one per statement.
+ */
+class TransactionBatcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit TransactionBatcher(QObject *parent = 0);
+
+    void setDatabase(const QSqlDatabase &database);
+    void setMaxLatency(int msec);
+
+    void addWrite();
+    bool flush();
+    bool inTransaction() const;
+
+    QVariantMap statistics() const;
+
+signals:
+    void committed();
+    void rolledBack();
+
+private slots:
+    void commit();
+
+private:
+    QSqlDatabase m_database;
+    QTimer m_idleTimer;
+    QTimer m_deadlineTimer;
+    bool m_inTransaction;
+    int m_pendingWrites;
+
+    // Statistics
+    int m_batchCount;
+    int m_writeCount;
+    int m_maxBatchSize;
+    int m_lastBatchSize;
+    int m_failedCommits;
+    qint64 m_totalCommitTime;
+    qint64 m_maxCommitTime;
+    qint64 m_lastCommitTime;
+};
+
+#endif // TRANSACTIONBATCHER_H
@@ -0,0 +1,46 @@
+/****************************************************************************
+**
+** Copyright (c) 2026 Jolla Ltd.
+**
+****************************************************************************/
+
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <QMutexLocker>
+
+#include "writebarrier.h"
+
+WriteBarrier::WriteBarrier()
+    : m_published(0)
+    , m_awaited(0)
+{
+}
+
+void WriteBarrier::publish(quint64 sequence)
+{
+    QMutexLocker lock(&m_mutex);
+    if (sequence > m_published) {
+        m_published = sequence;
+        m_condition.wakeAll();
+    }
+}
+
+void WriteBarrier::wait(quint64 sequence)
+{
+    QMutexLocker lock(&m_mutex);
+    while (m_published < sequence) {
+        m_awaited = sequence;
+        m_condition.wait(&m_mutex);
+    }
+    m_awaited = 0;
+}
+
+// True when a reader is blocked on the given write or an earlier one, the
+// writer should then commit instead of waiting for the batch to fill up.
+bool WriteBarrier::isAwaited(quint64 sequence) const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_awaited != 0 && m_awaited <= sequence;
+}
@@ -0,0 +1,40 @@
+/****************************************************************************
+**
+** Copyright (c) 2026 Jolla Ltd.
+**
+****************************************************************************/
+
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef WRITEBARRIER_H
+#define WRITEBARRIER_H
+
+#include <QMutex>
+#include <QWaitCondition>
+
+/**
+ * Lets the reader thread wait until the writer has committed a given write.
+ *
+ * Writes are numbered in the order they were requested. The writer publishes
+ * the number of the last write that is visible to other connections, and a
+ * reader waits until the writes requested before its query are published.
+ */
+class WriteBarrier
+{
+public:
+    WriteBarrier();
+
+    void publish(quint64 sequence);
+    void wait(quint64 sequence);
+    bool isAwaited(quint64 sequence) const;
+
+private:
+    mutable QMutex m_mutex;
+    QWaitCondition m_condition;
+    quint64 m_published;
+    quint64 m_awaited;
+};
+
+#endif // WRITEBARRIER_H
@@ -1,4 +1,5 @@
 TARGET = vault-browser
+QT += dbus
 INCLUDEPATH += $$PWD/../apps/core
 HEADERS += $$PWD/../apps/core/logging.h
 SOURCES += browserunit.cpp \
@@ -2,12 +2,16 @@
 #include <vault/unit.h>
 #include <QProcess>
 #include <QCoreApplication>
+#include <QDBusConnection>
+#include <QDBusConnectionInterface>
+#include <QDBusMessage>
 #include <QVariantList>
 #include <QVariantMap>
 #include <QDebug>
 #include <QLoggingCategory>
 #include <QFileInfo>
 #include <QDir>
+#include <QFile>
 #include <sys/types.h>
 #include <signal.h>
 #include <set>
@@ -93,6 +97,27 @@ const QVariantMap info = {
     , {"options", QVariantMap({{"overwrite", true}})}
 };
 
+// The running browser writes a copy of its database here when asked
+const QString snapshot = "/sailfish-browser.backup.sqlite";
+const QString browser_service = "org.sailfishos.browser";
+// Milliseconds to wait for the copy, it is made in small steps
+const int snapshot_timeout = 120000;
+
+// Same as info but without the database, which is taken from the snapshot,
+// and without the files of the Gecko profile. Gecko may be writing those and
+// only the browser database can be copied while the browser runs.
+const QVariantMap snapshot_info = {
+    {"home", QVariantMap({
+                {"data", QVariantList({
+                                  browser_dir + bookmarks
+                                })}
+                , {"bin", QVariantList({
+                                  cache_dir
+                                })
+                        }})}
+    , {"options", QVariantMap({{"overwrite", true}})}
+};
+
 // old paths
 const QString old_browser_dir = ".local/share/org.sailfishos/sailfish-browser";
 const QString old_moz_dir = ".mozilla/mozembed";
@@ -135,16 +160,78 @@ void fix_import()
     fix_dir(blobDir, old_cache_dir, cache_dir);
 }
 
+// The Gecko profile files cannot be copied safely while the browser runs
+bool has_gecko_files()
+{
+    return QFileInfo(QDir::home().absoluteFilePath(moz_dir + keys)).exists()
+            || QFileInfo(QDir::home().absoluteFilePath(moz_dir + signons)).exists();
+}
+
+QString snapshot_path()
+{
+    return QDir::home().absoluteFilePath(browser_dir + snapshot);
+}
+
+// Asks a running browser for a consistent copy of its database, made with
+// the SQLite online backup API. Returns false if the browser is not running
+// or the copy could not be made.
+bool snapshot_database()
+{
+    QDBusConnection bus = QDBusConnection::sessionBus();
+    // Do not get the browser started just for this
+    if (!bus.isConnected() || !bus.interface()->isServiceRegistered(browser_service)) {
+        return false;
+    }
+
+    qCDebug(lcBackupLog) << "Requesting database snapshot";
+    auto call = QDBusMessage::createMethodCall(browser_service, "/", browser_service, "backupDatabase");
+    call << snapshot_path();
+    auto reply = bus.call(call, QDBus::Block, snapshot_timeout);
+    if (reply.type() != QDBusMessage::ReplyMessage || !reply.arguments().value(0).toBool()) {
+        qCWarning(lcBackupLog) << "Database snapshot failed" << reply.errorMessage();
+        QFile::remove(snapshot_path());
+        return false;
+    }
+    return true;
+}
+
+// Moves the snapshot to where the database would have been archived
+bool store_snapshot()
+{
+    QFileInfo dest(vault::unit::optValue("bin-dir") + "/" + browser_dir + database);
+    dest.dir().mkpath(".");
+    QFile::remove(dest.absoluteFilePath());
+    if (!QFile::rename(snapshot_path(), dest.absoluteFilePath())) {
+        qCWarning(lcBackupLog) << "Storing database snapshot to" << dest.absoluteFilePath() << "failed";
+        return false;
+    }
+    return true;
+}
+
 int main(int argc, char *argv[])
 {
     QCoreApplication app(argc, argv);
+    auto const action = vault::unit::optValue("action");
+
+    // Exporting does not need to stop the browser if it can provide a
+    // snapshot of the database and there is no Gecko profile data to copy.
+    // Otherwise the browser is stopped so that the files are not written
+    // while copying them.
+    if (action == "export" && !has_gecko_files() && snapshot_database()) {
+        int res = vault::unit::execute(snapshot_info);
+        if (!store_snapshot() && !res)
+            res = 1;
+        QFile::remove(snapshot_path());
+        return res;
+    }
+
     try {
         stop_browser();
     } catch (std::exception const &e) {
         qCDebug(lcBackupLog) << e.what();
         return 1;
     }
-    if (vault::unit::optValue("action") == "import") {
+    if (action == "import") {
         fix_import();
     }
     return vault::unit::execute(info);
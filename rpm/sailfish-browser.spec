@@ -24,6 +24,7 @@ BuildRequires:  pkgconfig(systemsettings) >= %{min_systemsettings_version}
 BuildRequires:  pkgconfig(Qt5DBus)
 BuildRequires:  pkgconfig(Qt5Concurrent)
 BuildRequires:  pkgconfig(Qt5Sql)
+BuildRequires:  pkgconfig(sqlite3)
 BuildRequires:  pkgconfig(nemotransferengine-qt5)
 BuildRequires:  pkgconfig(mlite5)
 BuildRequires:  pkgconfig(qdeclarative5-boostable)
@@ -10,7 +10,9 @@
  * You can obtain one at http://mozilla.org/MPL/2.0/. */
 
 #include <QtTest>
+#include <QSqlQuery>
 #include "dbmanager.h"
+#include "dbworker.h"
 #include "browserpaths.h"
 
 Q_DECLARE_METATYPE(QList<Tab>)
@@ -36,15 +38,52 @@ private slots:
     void navigateTo();
     void goBack();
     void goForward();
+    void tabHistoryAfterRestart();
     void updateThumbPath();
     void updateTitle();
     void getHistory();
+    void supersededSearches();
+    void searchCache();
     void getTabHistory();
     void saveSetting();
     void deleteSetting();
+    void settingsBeforeLoaded();
+    void coalesceSettings();
     void getMaxTabId();
+    void tabOrdering();
+    void resultsInCallOrder();
+    void taskPriorities();
+    void batchedWrites();
+    void flushOnShutdown();
+    void statementCache();
+    void statementProfile();
+    void migrateSchema();
+    void internUrls();
+    void collectLinks();
+    void backup();
+    void searchHistory_data();
+    void searchHistory();
+    void frecencyRanking();
+    void paginateHistory();
+    void expireHistory();
+    void expireHistoryKeepsTabs();
+    void maintenance();
+
+    void benchmarkNavigateTo_data();
+    void benchmarkNavigateTo();
+    void benchmarkGetHistory_data();
+    void benchmarkGetHistory();
+    void benchmarkWriteLatency_data();
+    void benchmarkWriteLatency();
+    void benchmarkSearchHistory_data();
+    void benchmarkSearchHistory();
+    void benchmarkStartup_data();
+    void benchmarkStartup();
 
 private:
+    void waitForLoaded();
+    qint64 historyBytes(DBWorker &worker);
+
     QString mDbFile;
 };
 
@@ -62,6 +101,28 @@ void tst_dbmanager::cleanup()
     delete DBManager::instance();
     QFile dbFile(mDbFile);
     QVERIFY(dbFile.remove());
+    // Write-ahead log is normally removed when the last connection closes
+    QFile::remove(mDbFile + "-wal");
+    QFile::remove(mDbFile + "-shm");
+}
+
+void tst_dbmanager::waitForLoaded()
+{
+    if (!DBManager::instance()->isLoaded()) {
+        QSignalSpy loadedSpy(DBManager::instance(), SIGNAL(loaded()));
+        QVERIFY(loadedSpy.wait(5000));
+    }
+    QVERIFY(DBManager::instance()->isLoaded());
+}
+
+qint64 tst_dbmanager::historyBytes(DBWorker &worker)
+{
+    QSignalSpy statisticsSpy(&worker, SIGNAL(statisticsAvailable(QVariantMap)));
+    worker.getStatistics();
+    if (statisticsSpy.count() != 1) {
+        return -1;
+    }
+    return statisticsSpy.at(0).at(0).toMap().value("expiry").toMap().value("historyBytes").toLongLong();
 }
 
 void tst_dbmanager::createTab()
@@ -252,6 +313,12 @@ void tst_dbmanager::clearHistory()
         DBManager::instance()->createTab(tab);
     }
 
+    // A search made before clearing does not hold back the empty result
+    QSignalSpy searchSpy(DBManager::instance(), SIGNAL(historyAvailable(QList<Link>)));
+    DBManager::instance()->getHistory(QString());
+    QVERIFY(searchSpy.wait(5000));
+    QCOMPARE(searchSpy.at(0).at(0).value<QList<Link> >().count(), initialTabs.count());
+
     QSignalSpy tabsAvailableSpy(DBManager::instance(),
                                 SIGNAL(tabsAvailable(QList<Tab>)));
     QSignalSpy historyAvailableSpy(DBManager::instance(),
@@ -261,6 +328,7 @@ void tst_dbmanager::clearHistory()
     DBManager::instance()->clearHistory();
     QVERIFY(historyAvailableSpy.wait(5000));
     QCOMPARE(historyAvailableSpy.count(), 1);
+    QVERIFY(historyAvailableSpy.at(0).at(0).value<QList<Link> >().isEmpty());
     QCOMPARE(tabsAvailableSpy.count(), expectedTabsAvailable);
 }
 
@@ -356,6 +424,48 @@ void tst_dbmanager::goForward()
     QCOMPARE(currentLinkId, 3);
 }
 
+void tst_dbmanager::tabHistoryAfterRestart()
+{
+    Tab tab(1, "http://example1.com", "Test title 1", "");
+    DBManager::instance()->createTab(tab);
+    DBManager::instance()->navigateTo(1, "http://example2.com", "Test title 2", "");
+    DBManager::instance()->navigateTo(1, "http://example3.com", "Test title 3", "");
+    DBManager::instance()->goBack(1);
+    DBManager::instance()->navigateTo(1, "http://example4.com", "Test title 4", "");
+    DBManager::instance()->goBack(1);
+    DBManager::instance()->goBack(1);
+    // Already at the first entry
+    DBManager::instance()->goBack(1);
+    DBManager::instance()->goForward(1);
+    DBManager::instance()->updateTitle(1, "http://example2.com", "Changed title 2");
+
+    QSignalSpy tabHistoryAvailableSpy(DBManager::instance(),
+                                      SIGNAL(tabHistoryAvailable(int,QList<Link>,int)));
+    DBManager::instance()->getTabHistory(1);
+    QVERIFY(tabHistoryAvailableSpy.wait(5000));
+    QList<Link> links = tabHistoryAvailableSpy.at(0).at(1).value<QList<Link> >();
+    QCOMPARE(links.count(), 3);
+    QCOMPARE(links.at(0).url(), QString("http://example4.com"));
+    QCOMPARE(links.at(1).title(), QString("Changed title 2"));
+    QCOMPARE(tabHistoryAvailableSpy.at(0).at(2).toInt(), 2);
+
+    // The history kept in memory matches the one loaded from the database
+    delete DBManager::instance();
+
+    QSignalSpy restoredSpy(DBManager::instance(),
+                           SIGNAL(tabHistoryAvailable(int,QList<Link>,int)));
+    DBManager::instance()->getTabHistory(1);
+    QVERIFY(restoredSpy.wait(5000));
+    QList<Link> restoredLinks = restoredSpy.at(0).at(1).value<QList<Link> >();
+    QCOMPARE(restoredLinks.count(), links.count());
+    for (int i = 0; i < links.count(); ++i) {
+        QCOMPARE(restoredLinks.at(i).linkId(), links.at(i).linkId());
+        QCOMPARE(restoredLinks.at(i).url(), links.at(i).url());
+        QCOMPARE(restoredLinks.at(i).title(), links.at(i).title());
+    }
+    QCOMPARE(restoredSpy.at(0).at(2).toInt(), 2);
+}
+
 void tst_dbmanager::updateThumbPath()
 {
     // initialize test case
@@ -460,6 +570,88 @@ void tst_dbmanager::getHistory()
     QVERIFY(linkset.contains(QString("http://unneeded2.net")));
 }
 
+void tst_dbmanager::supersededSearches()
+{
+    DBManager::instance()->createTab(Tab(1, "http://example.com", "Example", ""));
+    DBManager::instance()->navigateTo(1, "http://github.com", "GitHub", "");
+    DBManager::instance()->navigateTo(1, "http://gitlab.com", "GitLab", "");
+
+    QSignalSpy historyAvailableSpy(DBManager::instance(),
+                                   SIGNAL(historyAvailable(QList<Link>)));
+
+    // One search per keystroke, only the last one is answered
+    DBManager::instance()->getHistory("g");
+    DBManager::instance()->getHistory("gi");
+    DBManager::instance()->getHistory("git");
+    DBManager::instance()->getHistory("gith");
+    QVERIFY(historyAvailableSpy.wait(5000));
+    // Results of the earlier searches would have come before
+    QTest::qWait(100);
+    QCOMPARE(historyAvailableSpy.count(), 1);
+    QList<Link> links = historyAvailableSpy.at(0).at(0).value<QList<Link> >();
+    QCOMPARE(links.count(), 1);
+    QCOMPARE(links.at(0).url(), QString("http://github.com"));
+
+    QVariantMap stats = DBManager::instance()->searchStatistics();
+    QCOMPARE(stats.value("requests").toInt(), 4);
+    QCOMPARE(stats.value("completed").toInt(), 1);
+    QVERIFY(stats.value("lastLatency").toLongLong() >= 0);
+
+    // Searches already queued on the reader are skipped
+    QAtomicInt generation(2);
+    DBWorker worker;
+    worker.setSearchGeneration(&generation);
+    QSignalSpy workerSpy(&worker, SIGNAL(historyAvailable(QList<Link>,int)));
+    worker.getHistory("git", 1);
+    QCOMPARE(workerSpy.count(), 0);
+}
+
+void tst_dbmanager::searchCache()
+{
+    DBManager::instance()->createTab(Tab(1, "http://example.com", "Example", ""));
+    DBManager::instance()->navigateTo(1, "http://github.com/sailfishos", "GitHub Sailfish OS", "");
+    DBManager::instance()->navigateTo(1, "http://github.com/mer-hybris", "GitHub Mer Hybris", "");
+    DBManager::instance()->navigateTo(1, "http://gitlab.com", "GitLab", "");
+
+    QSignalSpy historyAvailableSpy(DBManager::instance(),
+                                   SIGNAL(historyAvailable(QList<Link>)));
+    auto search = [&](const QString &filter) {
+        historyAvailableSpy.clear();
+        DBManager::instance()->getHistory(filter);
+        if (historyAvailableSpy.isEmpty() && !historyAvailableSpy.wait(5000)) {
+            return QStringList();
+        }
+        QStringList urls;
+        foreach (const Link &link, historyAvailableSpy.at(0).at(0).value<QList<Link> >()) {
+            urls << link.url();
+        }
+        urls.sort();
+        return urls;
+    };
+
+    QCOMPARE(search("git"), QStringList() << "http://github.com/mer-hybris" << "http://github.com/sailfishos" << "http://gitlab.com");
+    QVariantMap cache = DBManager::instance()->searchStatistics().value("cache").toMap();
+    QCOMPARE(cache.value("misses").toInt(), 1);
+    QCOMPARE(cache.value("hits").toInt(), 0);
+
+    // Narrowed from the results of "git"
+    QCOMPARE(search("gith"), QStringList() << "http://github.com/mer-hybris" << "http://github.com/sailfishos");
+    QCOMPARE(search("github sail"), QStringList() << "http://github.com/sailfishos");
+    QCOMPARE(search("git"), QStringList() << "http://github.com/mer-hybris" << "http://github.com/sailfishos" << "http://gitlab.com");
+    cache = DBManager::instance()->searchStatistics().value("cache").toMap();
+    QCOMPARE(cache.value("misses").toInt(), 1);
+    QCOMPARE(cache.value("hits").toInt(), 3);
+    QCOMPARE(cache.value("refinements").toInt(), 2);
+    QCOMPARE(cache.value("hitRate").toDouble(), 0.75);
+
+    // Writes drop the cached results
+    DBManager::instance()->navigateTo(1, "http://github.com/jolla", "GitHub Jolla", "");
+    QCOMPARE(search("gith"), QStringList() << "http://github.com/jolla" << "http://github.com/mer-hybris" << "http://github.com/sailfishos");
+    cache = DBManager::instance()->searchStatistics().value("cache").toMap();
+    QCOMPARE(cache.value("misses").toInt(), 2);
+    QCOMPARE(cache.value("invalidations").toInt(), 1);
+}
+
 void tst_dbmanager::getTabHistory()
 {
     // initialize test case
@@ -493,6 +685,7 @@ void tst_dbmanager::saveSetting()
 
     // delete to make sure the data is persistent and check
     delete DBManager::instance();
+    waitForLoaded();
     QCOMPARE(DBManager::instance()->getSetting("test_key"), QString("test_value"));
     QCOMPARE(DBManager::instance()->getSetting("nonexisting_key"), QString(""));
 
@@ -503,6 +696,7 @@ void tst_dbmanager::saveSetting()
     QCOMPARE(DBManager::instance()->getSetting("test_key"), QString("test_new_value"));
     QCOMPARE(settingChangedSpy2.count(), 1);
     delete DBManager::instance();
+    waitForLoaded();
     QCOMPARE(DBManager::instance()->getSetting("test_key"), QString("test_new_value"));
 }
 
@@ -518,17 +712,1082 @@ void tst_dbmanager::deleteSetting()
 
     // delete to make sure the data was deleted persistently and check
     delete DBManager::instance();
+    waitForLoaded();
     QCOMPARE(DBManager::instance()->getSetting("test_key"), QString(""));
 }
 
+void tst_dbmanager::settingsBeforeLoaded()
+{
+    DBManager::instance()->saveSetting("stored_key", "stored_value");
+    DBManager::instance()->saveSetting("deleted_key", "deleted_value");
+    DBManager::instance()->saveSetting("updated_key", "old_value");
+    delete DBManager::instance();
+
+    // Changes made while the database is still being opened win over the
+    // loaded snapshot and are written after it
+    QVERIFY(!DBManager::instance()->isLoaded());
+    DBManager::instance()->deleteSetting("deleted_key");
+    DBManager::instance()->saveSetting("updated_key", "new_value");
+    waitForLoaded();
+    QCOMPARE(DBManager::instance()->getSetting("stored_key"), QString("stored_value"));
+    QCOMPARE(DBManager::instance()->getSetting("deleted_key"), QString(""));
+    QCOMPARE(DBManager::instance()->getSetting("updated_key"), QString("new_value"));
+
+    delete DBManager::instance();
+    waitForLoaded();
+    QCOMPARE(DBManager::instance()->getSetting("stored_key"), QString("stored_value"));
+    QCOMPARE(DBManager::instance()->getSetting("deleted_key"), QString(""));
+    QCOMPARE(DBManager::instance()->getSetting("updated_key"), QString("new_value"));
+}
+
+void tst_dbmanager::coalesceSettings()
+{
+    waitForLoaded();
+
+    // Switching tabs repeatedly stores the last active tab once
+    for (int i = 1; i <= 10; ++i) {
+        DBManager::instance()->saveSetting("activeTabId", QString::number(i));
+    }
+    DBManager::instance()->saveSetting("deleted_key", "value");
+    DBManager::instance()->deleteSetting("deleted_key");
+    QCOMPARE(DBManager::instance()->getSetting("activeTabId"), QString("10"));
+
+    // Nothing is written before the write delay has passed
+    QSignalSpy statisticsSpy(DBManager::instance(), SIGNAL(statisticsAvailable(QVariantMap)));
+    DBManager::instance()->getStatistics();
+    QVERIFY(statisticsSpy.wait(5000));
+    QVariantMap transactions = statisticsSpy.at(0).at(0).toMap().value("transactions").toMap();
+    const int writesBefore = transactions.value("writeCount").toInt() + transactions.value("pendingWrites").toInt();
+
+    DBManager::instance()->flushSettings().waitForFinished();
+    DBManager::instance()->getStatistics();
+    QVERIFY(statisticsSpy.wait(5000));
+    transactions = statisticsSpy.at(1).at(0).toMap().value("transactions").toMap();
+    QCOMPARE(transactions.value("writeCount").toInt() + transactions.value("pendingWrites").toInt(),
+             writesBefore + 2);
+
+    delete DBManager::instance();
+    waitForLoaded();
+    QCOMPARE(DBManager::instance()->getSetting("activeTabId"), QString("10"));
+    QCOMPARE(DBManager::instance()->getSetting("deleted_key"), QString(""));
+}
+
 void tst_dbmanager::getMaxTabId()
 {
-    QCOMPARE(DBManager::instance()->getMaxTabId(), 0);
+    QCOMPARE(DBManager::instance()->getMaxTabId().result(), 0);
 
     const Tab tab(1, "http://example.com", "Test title", "");
-    DBManager::instance()->createTab(tab);
+    QFuture<void> created = DBManager::instance()->createTab(tab);
+
+    QFuture<int> maxTabId = DBManager::instance()->getMaxTabId();
+    QCOMPARE(maxTabId.result(), 1);
+    QVERIFY(created.isFinished());
+}
+
+void tst_dbmanager::tabOrdering()
+{
+    // Calls for two tabs interleaved without waiting for any of them
+    DBManager::instance()->createTab(Tab(1, "http://example1.com", "Tab 1 title 1", ""));
+    DBManager::instance()->createTab(Tab(2, "http://example4.com", "Tab 2 title 1", ""));
+    DBManager::instance()->navigateTo(1, "http://example2.com", "Tab 1 title 2", "");
+    DBManager::instance()->navigateTo(2, "http://example5.com", "Tab 2 title 2", "");
+    DBManager::instance()->navigateTo(1, "http://example3.com", "Tab 1 title 3", "");
+    DBManager::instance()->goBack(1);
+    DBManager::instance()->goBack(2);
+    DBManager::instance()->goBack(1);
+    DBManager::instance()->goForward(1);
+    DBManager::instance()->updateTitle(1, "http://example2.com", "Tab 1 new title");
+    QFuture<void> lastWrite = DBManager::instance()->updateTitle(2, "http://example4.com", "Tab 2 new title");
+
+    QSignalSpy tabHistoryAvailableSpy(DBManager::instance(),
+                                      SIGNAL(tabHistoryAvailable(int,QList<Link>,int)));
+    DBManager::instance()->getTabHistory(1);
+    DBManager::instance()->getTabHistory(2);
+    QVERIFY(tabHistoryAvailableSpy.wait(5000));
+    // Queries run only after the writes made before them
+    QVERIFY(lastWrite.isFinished());
+    if (tabHistoryAvailableSpy.count() < 2) {
+        QVERIFY(tabHistoryAvailableSpy.wait(5000));
+    }
+
+    // Tab 1: back twice and forward once lands on the second link
+    QList<QVariant> arguments = tabHistoryAvailableSpy.at(0);
+    QCOMPARE(arguments.at(0).toInt(), 1);
+    QList<Link> links = arguments.at(1).value<QList<Link> >();
+    int currentLinkId = arguments.at(2).toInt();
+    QCOMPARE(links.count(), 3);
+    bool found = false;
+    for (const Link &link : links) {
+        if (link.linkId() == currentLinkId) {
+            QCOMPARE(link.url(), QString("http://example2.com"));
+            QCOMPARE(link.title(), QString("Tab 1 new title"));
+            found = true;
+        }
+    }
+    QVERIFY(found);
+
+    // Tab 2: back once lands on the first link
+    arguments = tabHistoryAvailableSpy.at(1);
+    QCOMPARE(arguments.at(0).toInt(), 2);
+    links = arguments.at(1).value<QList<Link> >();
+    currentLinkId = arguments.at(2).toInt();
+    QCOMPARE(links.count(), 2);
+    found = false;
+    for (const Link &link : links) {
+        if (link.linkId() == currentLinkId) {
+            QCOMPARE(link.url(), QString("http://example4.com"));
+            QCOMPARE(link.title(), QString("Tab 2 new title"));
+            found = true;
+        }
+    }
+    QVERIFY(found);
+}
+
+void tst_dbmanager::resultsInCallOrder()
+{
+    DBManager::instance()->createTab(Tab(1, "http://example1.com", "Test title 1", ""));
+
+    // Query runs on the reader, the thumbnail update on the writer. Signals
+    // still arrive in the order of the calls.
+    QStringList results;
+    connect(DBManager::instance(), &DBManager::tabHistoryAvailable,
+            [&results](int tabId, QList<Link>) { results << QString("history %1").arg(tabId); });
+    connect(DBManager::instance(), &DBManager::thumbPathChanged,
+            [&results](int tabId, const QString &) { results << QString("thumb %1").arg(tabId); });
+    QSignalSpy thumbPathChangedSpy(DBManager::instance(), SIGNAL(thumbPathChanged(int,QString)));
+
+    DBManager::instance()->getTabHistory(1);
+    DBManager::instance()->updateThumbPath(1, "/tmp/thumb1.png");
+    DBManager::instance()->getTabHistory(1);
+    DBManager::instance()->updateThumbPath(1, "/tmp/thumb2.png");
+    DBManager::instance()->getTabHistory(1);
+
+    QTRY_COMPARE_WITH_TIMEOUT(results.count(), 5, 5000);
+    QCOMPARE(results, QStringList() << "history 1" << "thumb 1" << "history 1" << "thumb 1" << "history 1");
+    QCOMPARE(thumbPathChangedSpy.count(), 2);
+}
+
+void tst_dbmanager::taskPriorities()
+{
+    // The worker lives on this thread, posted tasks run once events are sent
+    DBWorker worker;
+    QStringList order;
+    worker.post(new DBTask([&order]() { order << "background 1"; }, BackgroundPriority, 1));
+    worker.post(new DBTask([&order]() { order << "user-visible 1"; }, UserVisiblePriority, 2));
+    worker.post(new DBTask([&order]() { order << "background 2"; }, BackgroundPriority, 4));
+    worker.post(new DBTask([&order]() { order << "user-visible 2"; }, UserVisiblePriority, 5));
+    QCoreApplication::sendPostedEvents(&worker);
+    QCOMPARE(order, QStringList() << "user-visible 1" << "user-visible 2"
+                                  << "background 1" << "background 2");
+
+    // A call reading what background tasks write gets the earlier ones run first
+    order.clear();
+    worker.post(new DBTask([&order]() { order << "background 3"; }, BackgroundPriority, 6));
+    worker.post(new DBTask([&order, &worker]() {
+        worker.runBackgroundTasks();
+        order << "tab query";
+    }, UserVisiblePriority, 7));
+    worker.post(new DBTask([&order]() { order << "background 4"; }, BackgroundPriority, 8));
+    QCoreApplication::sendPostedEvents(&worker);
+    QCOMPARE(order, QStringList() << "background 3" << "tab query" << "background 4");
+
+    QSignalSpy statisticsSpy(&worker, SIGNAL(statisticsAvailable(QVariantMap)));
+    worker.getStatistics();
+    QCOMPARE(statisticsSpy.count(), 1);
+    QVariantMap scheduling = statisticsSpy.at(0).at(0).toMap().value("scheduling").toMap();
+    QCOMPARE(scheduling.value("foregroundTasks").toInt(), 3);
+    QCOMPARE(scheduling.value("backgroundTasks").toInt(), 3);
+    QCOMPARE(scheduling.value("promotedTasks").toInt(), 1);
+    QCOMPARE(scheduling.value("maxBackgroundQueue").toInt(), 2);
+}
+
+void tst_dbmanager::batchedWrites()
+{
+    DBManager::instance()->createTab(Tab(1, "http://example1.com", "Test title 1", ""));
+    DBManager::instance()->navigateTo(1, "http://example2.com", "Test title 2", "");
+    DBManager::instance()->navigateTo(1, "http://example3.com", "Test title 3", "");
+    DBManager::instance()->updateTitle(1, "http://example3.com", "New title 3");
+
+    QSignalSpy tabHistoryAvailableSpy(DBManager::instance(),
+                                      SIGNAL(tabHistoryAvailable(int,QList<Link>,int)));
+    DBManager::instance()->getTabHistory(1);
+    QVERIFY(tabHistoryAvailableSpy.wait(5000));
+    QCOMPARE(tabHistoryAvailableSpy.at(0).at(1).value<QList<Link> >().count(), 3);
+
+    // Let the batch deadline pass so that all writes are committed
+    QTest::qWait(200);
+
+    QSignalSpy statisticsSpy(DBManager::instance(), SIGNAL(statisticsAvailable(QVariantMap)));
+    DBManager::instance()->getStatistics();
+    QVERIFY(statisticsSpy.wait(5000));
+    QVariantMap transactions = statisticsSpy.at(0).at(0).toMap().value("transactions").toMap();
+    QCOMPARE(transactions.value("writeCount").toInt(), 4);
+    QCOMPARE(transactions.value("pendingWrites").toInt(), 0);
+    QCOMPARE(transactions.value("failedCommits").toInt(), 0);
+    QVERIFY(transactions.value("batchCount").toInt() >= 1);
+    QVERIFY(transactions.value("batchCount").toInt() <= 4);
+}
+
+void tst_dbmanager::flushOnShutdown()
+{
+    DBManager::instance()->createTab(Tab(1, "http://example1.com", "Test title 1", ""));
+    DBManager::instance()->navigateTo(1, "http://example2.com", "Test title 2", "");
+
+    // Pending batch must be committed when the manager goes away
+    delete DBManager::instance();
+
+    QSignalSpy tabsAvailableSpy(DBManager::instance(),
+                                SIGNAL(tabsAvailable(QList<Tab>)));
+    DBManager::instance()->getAllTabs();
+    QVERIFY(tabsAvailableSpy.wait(5000));
+    QList<Tab> tabs = tabsAvailableSpy.at(0).at(0).value<QList<Tab> >();
+    QCOMPARE(tabs.count(), 1);
+    QCOMPARE(tabs.at(0).url(), QString("http://example2.com"));
+}
+
+void tst_dbmanager::statementCache()
+{
+    DBManager::instance()->createTab(Tab(1, "http://example1.com", "Test title 1", ""));
+    DBManager::instance()->navigateTo(1, "http://example2.com", "Test title 2", "");
+    DBManager::instance()->navigateTo(1, "http://example3.com", "Test title 3", "");
+
+    QSignalSpy statisticsSpy(DBManager::instance(), SIGNAL(statisticsAvailable(QVariantMap)));
+    DBManager::instance()->getStatistics();
+    QVERIFY(statisticsSpy.wait(5000));
+    QVariantMap statements = statisticsSpy.at(0).at(0).toMap().value("statements").toMap();
+    int cached = statements.value("cached").toInt();
+    int hits = statements.value("hits").toInt();
+    QVERIFY(cached > 0);
+    QVERIFY(hits > 0);
+
+    // Repeating the same operations must not prepare anything new
+    DBManager::instance()->navigateTo(1, "http://example4.com", "Test title 4", "");
+    DBManager::instance()->getStatistics();
+    QVERIFY(statisticsSpy.wait(5000));
+    statements = statisticsSpy.at(1).at(0).toMap().value("statements").toMap();
+    QCOMPARE(statements.value("cached").toInt(), cached);
+    QVERIFY(statements.value("hits").toInt() > hits);
+}
+
+void tst_dbmanager::statementProfile()
+{
+    waitForLoaded();
+
+    // Disabled by default
+    DBManager::instance()->createTab(Tab(1, "http://example1.com", "Test title 1", "")).waitForFinished();
+    QVariantMap profile = DBManager::instance()->statementProfile();
+    QVERIFY(!profile.value("enabled").toBool());
+    QVERIFY(profile.value("statements").toList().isEmpty());
+
+    // Every execution counts as slow with a zero threshold
+    DBManager::instance()->setStatementProfiling(true, 0);
+    DBManager::instance()->navigateTo(1, "http://example2.com", "Test title 2", "");
+    DBManager::instance()->navigateTo(1, "http://example3.com", "Test title 3", "");
+    DBManager::instance()->getMaxTabId().waitForFinished();
+
+    profile = DBManager::instance()->statementProfile();
+    QVERIFY(profile.value("enabled").toBool());
+    QCOMPARE(profile.value("slowQueryThreshold").toInt(), 0);
+
+    QVariantMap insertTabHistory;
+    foreach (const QVariant &statement, profile.value("statements").toList()) {
+        QVariantMap entry = statement.toMap();
+        if (entry.value("statement").toString().startsWith("INSERT INTO tab_history")) {
+            insertTabHistory = entry;
+        }
+    }
+    QCOMPARE(insertTabHistory.value("count").toInt(), 2);
+    QCOMPARE(insertTabHistory.value("rows").toInt(), 2);
+    int histogramCount = 0;
+    foreach (const QVariant &bucket, insertTabHistory.value("histogram").toList()) {
+        histogramCount += bucket.toMap().value("count").toInt();
+    }
+    QCOMPARE(histogramCount, 2);
+    QVERIFY(insertTabHistory.value("maxTime").toLongLong() >= insertTabHistory.value("averageTime").toLongLong());
 
-    QCOMPARE(DBManager::instance()->getMaxTabId(), 1);
+    QVERIFY(profile.value("slowQueryCount").toInt() >= 2);
+    QVERIFY(!profile.value("slowQueries").toList().isEmpty());
+
+    // The writer reports the profile with its statistics too
+    QSignalSpy statisticsSpy(DBManager::instance(), SIGNAL(statisticsAvailable(QVariantMap)));
+    DBManager::instance()->getStatistics();
+    QVERIFY(statisticsSpy.wait(5000));
+    QVERIFY(statisticsSpy.at(0).at(0).toMap().contains("profile"));
+
+    DBManager::instance()->setStatementProfiling(false, 0);
+}
+
+void tst_dbmanager::migrateSchema()
+{
+    // Database as created by schema version 1
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", "migration");
+        db.setDatabaseName(mDbFile);
+        QVERIFY(db.open());
+        QSqlQuery query(db);
+        QVERIFY(query.exec("CREATE TABLE tab (tab_id INTEGER PRIMARY KEY, tab_history_id INTEGER);"));
+        QVERIFY(query.exec("CREATE TABLE tab_history (id INTEGER PRIMARY KEY AUTOINCREMENT, tab_id INTEGER, link_id INTEGER, date INT);"));
+        QVERIFY(query.exec("CREATE TABLE link (link_id INTEGER PRIMARY KEY AUTOINCREMENT, url TEXT, title TEXT, thumb_path TEXT);"));
+        QVERIFY(query.exec("CREATE TABLE browser_history (id INTEGER PRIMARY KEY AUTOINCREMENT, url TEXT UNIQUE, title TEXT, "
+                           "favorite_icon TEXT, visited_count INTEGER DEFAULT 1, date INTEGER);"));
+        QVERIFY(query.exec("CREATE TABLE settings (name TEXT PRIMARY KEY, value TEXT);"));
+        QVERIFY(query.exec("INSERT INTO tab VALUES (1, 2);"));
+        QVERIFY(query.exec("INSERT INTO link VALUES (1, 'http://example1.com', 'Test title 1', '');"));
+        QVERIFY(query.exec("INSERT INTO link VALUES (2, 'http://example2.com', 'Test title 2', '');"));
+        QVERIFY(query.exec("INSERT INTO tab_history VALUES (1, 1, 1, 1000);"));
+        QVERIFY(query.exec("INSERT INTO tab_history VALUES (2, 1, 2, 2000);"));
+        QVERIFY(query.exec("INSERT INTO browser_history (url, title, date) VALUES ('http://example1.com', 'Test title 1', 1000);"));
+        QVERIFY(query.exec("INSERT INTO browser_history (url, title, date) VALUES ('http://example2.com', 'Test title 2', 2000);"));
+        QVERIFY(query.exec("INSERT INTO settings VALUES ('test_key', 'test_value');"));
+        QVERIFY(query.exec("PRAGMA user_version=1;"));
+    }
+    QSqlDatabase::removeDatabase("migration");
+
+    QCOMPARE(DBManager::instance()->getSetting("test_key"), QString("test_value"));
+
+    QSignalSpy tabHistoryAvailableSpy(DBManager::instance(),
+                                      SIGNAL(tabHistoryAvailable(int,QList<Link>,int)));
+    DBManager::instance()->getTabHistory(1);
+    QVERIFY(tabHistoryAvailableSpy.wait(5000));
+    QList<Link> links = tabHistoryAvailableSpy.at(0).at(1).value<QList<Link> >();
+    QCOMPARE(links.count(), 2);
+    QCOMPARE(tabHistoryAvailableSpy.at(0).at(2).toInt(), 2);
+
+    QSignalSpy historyAvailableSpy(DBManager::instance(),
+                                   SIGNAL(historyAvailable(QList<Link>)));
+    DBManager::instance()->getHistory(QString());
+    QVERIFY(historyAvailableSpy.wait(5000));
+    links = historyAvailableSpy.at(0).at(0).value<QList<Link> >();
+    QCOMPARE(links.count(), 2);
+    QCOMPARE(links.at(0).url(), QString("http://example2.com"));
+
+    delete DBManager::instance();
+
+    // Check that the indices were added
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", "migration");
+        db.setDatabaseName(mDbFile);
+        QVERIFY(db.open());
+        QSqlQuery query(db);
+        QVERIFY(query.exec("PRAGMA user_version;"));
+        QVERIFY(query.first());
+        QVERIFY(query.value(0).toInt() >= 5);
+        QVERIFY(query.exec("SELECT COUNT(*) FROM sqlite_master WHERE type = 'index' AND name IN "
+                           "('tab_history_tab_id', 'tab_history_link_id', 'browser_history_date', 'link_url_id');"));
+        QVERIFY(query.first());
+        QCOMPARE(query.value(0).toInt(), 4);
+
+        // Small enough to be converted to incremental vacuum at startup
+        QVERIFY(query.exec("PRAGMA auto_vacuum;"));
+        QVERIFY(query.first());
+        QCOMPARE(query.value(0).toInt(), 2);
+
+        // Urls are found by their hash, the url text is not indexed
+        QVERIFY(query.exec("SELECT COUNT(*) FROM sqlite_master WHERE type = 'index' AND tbl_name = 'url' "
+                           "AND name IN ('url_hash', 'url_unreferenced');"));
+        QVERIFY(query.first());
+        QCOMPARE(query.value(0).toInt(), 2);
+        QVERIFY(query.exec("SELECT COUNT(*) FROM sqlite_master WHERE type = 'index' AND name LIKE 'sqlite_autoindex_url%';"));
+        QVERIFY(query.first());
+        QCOMPARE(query.value(0).toInt(), 0);
+        QVERIFY(query.exec("SELECT url, hash FROM url;"));
+        while (query.next()) {
+            QCOMPARE(query.value(1).toLongLong(), DBWorker::urlHash(query.value(0).toString()));
+        }
+
+        // Both urls are referenced by a link and a history entry
+        QVERIFY(query.exec("SELECT url, refcount FROM url ORDER BY url;"));
+        QVERIFY(query.next());
+        QCOMPARE(query.value(0).toString(), QString("http://example1.com"));
+        QCOMPARE(query.value(1).toInt(), 2);
+        QVERIFY(query.next());
+        QCOMPARE(query.value(0).toString(), QString("http://example2.com"));
+        QCOMPARE(query.value(1).toInt(), 2);
+        QVERIFY(!query.next());
+    }
+    QSqlDatabase::removeDatabase("migration");
+
+    // Visiting a migrated url again finds it by its hash
+    DBManager::instance()->navigateTo(1, "http://example1.com", "Test title 1", "");
+    delete DBManager::instance();
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", "migration");
+        db.setDatabaseName(mDbFile);
+        QVERIFY(db.open());
+        QSqlQuery query(db);
+        QVERIFY(query.exec("SELECT COUNT(*), MAX(visited_count) FROM url JOIN browser_history ON browser_history.url_id = url.id "
+                           "WHERE url.url = 'http://example1.com';"));
+        QVERIFY(query.first());
+        QCOMPARE(query.value(0).toInt(), 1);
+        QCOMPARE(query.value(1).toInt(), 2);
+    }
+    QSqlDatabase::removeDatabase("migration");
+}
+
+void tst_dbmanager::internUrls()
+{
+    DBManager::instance()->createTab(Tab(1, "http://example1.com", "Test title 1", ""));
+    DBManager::instance()->navigateTo(1, "http://example2.com", "Test title 2", "");
+    DBManager::instance()->navigateTo(1, "http://example1.com", "Test title 1", "");
+    DBManager::instance()->createTab(Tab(2, "http://example1.com", "Test title 1", ""));
+    delete DBManager::instance();
+
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", "interning");
+        db.setDatabaseName(mDbFile);
+        QVERIFY(db.open());
+        QSqlQuery query(db);
+        // Four links and two history entries share two urls
+        QVERIFY(query.exec("SELECT url, refcount FROM url ORDER BY url;"));
+        QVERIFY(query.next());
+        QCOMPARE(query.value(0).toString(), QString("http://example1.com"));
+        QCOMPARE(query.value(1).toInt(), 4);
+        QVERIFY(query.next());
+        QCOMPARE(query.value(0).toString(), QString("http://example2.com"));
+        QCOMPARE(query.value(1).toInt(), 2);
+        QVERIFY(!query.next());
+    }
+    QSqlDatabase::removeDatabase("interning");
+
+    DBManager::instance()->clearHistory();
+    delete DBManager::instance();
+
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", "interning");
+        db.setDatabaseName(mDbFile);
+        QVERIFY(db.open());
+        QSqlQuery query(db);
+        QVERIFY(query.exec("SELECT COUNT(*) FROM url;"));
+        QVERIFY(query.first());
+        QCOMPARE(query.value(0).toInt(), 0);
+    }
+    QSqlDatabase::removeDatabase("interning");
+}
+
+void tst_dbmanager::collectLinks()
+{
+    // Closed tabs take their links with them
+    for (int i = 1; i <= 100; ++i) {
+        DBManager::instance()->createTab(Tab(i, QString("http://example.com/%1").arg(i), "Test title", ""));
+        DBManager::instance()->navigateTo(i, "http://example.com/a", "Test title a", "");
+        DBManager::instance()->navigateTo(i, "http://example.com/b", "Test title b", "");
+        DBManager::instance()->goBack(i);
+        // Drops the forward entry
+        DBManager::instance()->navigateTo(i, "http://example.com/c", "Test title c", "");
+        if (i > 1) {
+            DBManager::instance()->removeTab(i - 1);
+        }
+    }
+    delete DBManager::instance();
+
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", "links");
+        db.setDatabaseName(mDbFile);
+        QVERIFY(db.open());
+        QSqlQuery query(db);
+        // Only the three entries of the last tab are left
+        QVERIFY(query.exec("SELECT COUNT(*) FROM link;"));
+        QVERIFY(query.first());
+        QCOMPARE(query.value(0).toInt(), 3);
+        QVERIFY(query.exec("SELECT COUNT(*) FROM link WHERE link_id NOT IN (SELECT link_id FROM tab_history);"));
+        QVERIFY(query.first());
+        QCOMPARE(query.value(0).toInt(), 0);
+
+        // Links leaked by older versions
+        QVERIFY(query.exec("DROP TRIGGER tab_history_link_release;"));
+        QVERIFY(query.exec("PRAGMA user_version=5;"));
+        QVERIFY(db.transaction());
+        QVERIFY(query.prepare("INSERT INTO link (url_id, title, thumb_path) "
+                              "VALUES ((SELECT id FROM url WHERE url = 'http://example.com/a'), ?, '');"));
+        for (int i = 0; i < 1200; ++i) {
+            query.bindValue(0, QString("Leaked %1").arg(i));
+            QVERIFY(query.exec());
+        }
+        QVERIFY(db.commit());
+    }
+    QSqlDatabase::removeDatabase("links");
+
+    {
+        DBWorker worker;
+        worker.init();
+
+        QSqlDatabase db = QSqlDatabase::database();
+        QSqlQuery query(db);
+        QVERIFY(query.exec("SELECT COUNT(*) FROM sqlite_master WHERE type = 'trigger' AND name = 'tab_history_link_release';"));
+        QVERIFY(query.first());
+        QCOMPARE(query.value(0).toInt(), 1);
+
+        // A batch at a time
+        worker.collectLinks();
+        worker.flush();
+        QVERIFY(query.exec("SELECT COUNT(*) FROM link;"));
+        QVERIFY(query.first());
+        QCOMPARE(query.value(0).toInt(), 1203 - 500);
+
+        worker.collectLinks();
+        worker.collectLinks();
+        worker.collectLinks();
+        worker.flush();
+        QVERIFY(query.exec("SELECT COUNT(*) FROM link;"));
+        QVERIFY(query.first());
+        QCOMPARE(query.value(0).toInt(), 3);
+
+        // The url of the leaked links is still used by the last tab
+        QVERIFY(query.exec("SELECT refcount FROM url WHERE url = 'http://example.com/a';"));
+        QVERIFY(query.first());
+        QCOMPARE(query.value(0).toInt(), 2);
+    }
+}
+
+void tst_dbmanager::backup()
+{
+    const QString backupFile = mDbFile + ".backup";
+    QFile::remove(backupFile);
+
+    {
+        DBWorker worker;
+        worker.init();
+        worker.setHistoryLimits(0, 0);
+        worker.createTab(Tab(1, "http://example.com", "Test title", ""));
+        // Enough pages for several backup steps
+        for (int i = 0; i < 2000; ++i) {
+            worker.navigateTo(1, QString("http://example.com/%1").arg(i), QString("Test title %1").arg(i), "");
+        }
+
+        QSignalSpy finishedSpy(&worker, SIGNAL(backupFinished(QString,bool)));
+        worker.backup(backupFile);
+        QVERIFY(finishedSpy.isEmpty());
+        // Written while the copy is being made
+        worker.navigateTo(1, "http://example.com/during", "During backup", "");
+        worker.saveSetting("backup", "during");
+
+        QVERIFY(finishedSpy.wait(10000));
+        QCOMPARE(finishedSpy.count(), 1);
+        QCOMPARE(finishedSpy.at(0).at(0).toString(), backupFile);
+        QVERIFY(finishedSpy.at(0).at(1).toBool());
+        QVERIFY(!QFile::exists(backupFile + ".part"));
+
+        // The database stays usable
+        worker.navigateTo(1, "http://example.com/after", "After backup", "");
+        worker.flush();
+        QSqlQuery query(QSqlDatabase::database());
+        QVERIFY(query.exec("SELECT COUNT(*) FROM browser_history;"));
+        QVERIFY(query.first());
+        QCOMPARE(query.value(0).toInt(), 2003);
+    }
+
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", "backup");
+        db.setDatabaseName(backupFile);
+        QVERIFY(db.open());
+        QSqlQuery query(db);
+        QVERIFY(query.exec("PRAGMA integrity_check;"));
+        QVERIFY(query.first());
+        QCOMPARE(query.value(0).toString(), QString("ok"));
+        // A single file, no write-ahead log next to it
+        QVERIFY(query.exec("PRAGMA journal_mode;"));
+        QVERIFY(query.first());
+        QCOMPARE(query.value(0).toString(), QString("delete"));
+
+        QVERIFY(query.exec("SELECT COUNT(*) FROM browser_history;"));
+        QVERIFY(query.first());
+        QCOMPARE(query.value(0).toInt(), 2002);
+        QVERIFY(query.exec("SELECT COUNT(*) FROM browser_history JOIN url ON url.id = browser_history.url_id "
+                           "WHERE url.url = 'http://example.com/during';"));
+        QVERIFY(query.first());
+        QCOMPARE(query.value(0).toInt(), 1);
+        QVERIFY(query.exec("SELECT value FROM settings WHERE name = 'backup';"));
+        QVERIFY(query.first());
+        QCOMPARE(query.value(0).toString(), QString("during"));
+    }
+    QSqlDatabase::removeDatabase("backup");
+    QVERIFY(QFile::remove(backupFile));
+}
+
+void tst_dbmanager::searchHistory_data()
+{
+    QTest::addColumn<QString>("filter");
+    QTest::addColumn<QStringList>("expectedUrls");
+
+    QTest::newRow("url_prefix") << "sailf" << (QStringList() << "http://sailfishos.org/wiki" << "http://forum.sailfishos.org");
+    QTest::newRow("url_path") << "wiki" << (QStringList() << "http://sailfishos.org/wiki");
+    QTest::newRow("title_prefix") << "Brows" << (QStringList() << "http://example.com/browser");
+    QTest::newRow("multiple_words") << "sailfish forum" << (QStringList() << "http://forum.sailfishos.org");
+    QTest::newRow("words_in_url_and_title") << "example engine" << (QStringList() << "http://example.com/browser");
+    QTest::newRow("no_match") << "jolla" << QStringList();
+    QTest::newRow("punctuation") << "sailfishos.org/" << (QStringList() << "http://sailfishos.org/wiki" << "http://forum.sailfishos.org");
+}
+
+void tst_dbmanager::searchHistory()
+{
+    QFETCH(QString, filter);
+    QFETCH(QStringList, expectedUrls);
+
+    DBManager::instance()->createTab(Tab(1, "http://sailfishos.org/wiki", "Wiki", ""));
+    DBManager::instance()->navigateTo(1, "http://forum.sailfishos.org", "Community forum", "");
+    DBManager::instance()->navigateTo(1, "http://example.com/browser", "Browser engine", "");
+
+    QSignalSpy historyAvailableSpy(DBManager::instance(),
+                                   SIGNAL(historyAvailable(QList<Link>)));
+    DBManager::instance()->getHistory(filter);
+    QVERIFY(historyAvailableSpy.wait(5000));
+    QList<Link> links = historyAvailableSpy.at(0).at(0).value<QList<Link> >();
+    QStringList urls;
+    for (const Link &link : links) {
+        urls << link.url();
+    }
+    urls.sort();
+    expectedUrls.sort();
+    QCOMPARE(urls, expectedUrls);
+}
+
+void tst_dbmanager::frecencyRanking()
+{
+    // Often visited page first, then a single recent visit to another one
+    DBManager::instance()->createTab(Tab(1, "http://example-often.com", "Often", ""));
+    DBManager::instance()->navigateTo(1, "http://other.com", "Other", "");
+    DBManager::instance()->navigateTo(1, "http://example-often.com", "Often", "");
+    DBManager::instance()->navigateTo(1, "http://other.com", "Other", "");
+    DBManager::instance()->navigateTo(1, "http://example-often.com", "Often", "");
+    DBManager::instance()->createTab(Tab(2, "http://example-recent.com", "Recent", ""));
+
+    QSignalSpy historyAvailableSpy(DBManager::instance(),
+                                   SIGNAL(historyAvailable(QList<Link>)));
+    DBManager::instance()->getHistory("example");
+    QVERIFY(historyAvailableSpy.wait(5000));
+    QList<Link> links = historyAvailableSpy.at(0).at(0).value<QList<Link> >();
+    QCOMPARE(links.count(), 2);
+    QCOMPARE(links.at(0).url(), QString("http://example-often.com"));
+    QCOMPARE(links.at(1).url(), QString("http://example-recent.com"));
+
+    // History page still lists the latest visit first
+    DBManager::instance()->getHistory(QString());
+    QVERIFY(historyAvailableSpy.wait(5000));
+    links = historyAvailableSpy.at(1).at(0).value<QList<Link> >();
+    QCOMPARE(links.count(), 3);
+    QCOMPARE(links.at(0).url(), QString("http://example-recent.com"));
+}
+
+void tst_dbmanager::paginateHistory()
+{
+    const int entries = DBManager::historyPageSize() * 2 + 5;
+    DBManager::instance()->createTab(Tab(1, "http://example.com/0", "Page 0", ""));
+    for (int i = 1; i < entries; ++i) {
+        DBManager::instance()->navigateTo(1, QString("http://example.com/%1").arg(i),
+                                          QString("Page %1").arg(i), "");
+    }
+
+    QSignalSpy historyAvailableSpy(DBManager::instance(),
+                                   SIGNAL(historyAvailable(QList<Link>)));
+    QSignalSpy moreHistoryAvailableSpy(DBManager::instance(),
+                                       SIGNAL(moreHistoryAvailable(QString,int,QList<Link>)));
+    DBManager::instance()->getHistory("");
+    QVERIFY(historyAvailableSpy.wait(5000));
+    QList<Link> links = historyAvailableSpy.at(0).at(0).value<QList<Link> >();
+    QCOMPARE(links.count(), DBManager::historyPageSize());
+
+    QSet<QString> urls;
+    for (const Link &link : links) {
+        urls.insert(link.url());
+    }
+
+    // The last row may be gone by the time the next page is fetched
+    DBManager::instance()->removeHistoryEntry(links.last().linkId());
+
+    QList<int> expectedPageSizes { DBManager::historyPageSize(), 5, 0 };
+    for (int expected : expectedPageSizes) {
+        const int afterLinkId = links.last().linkId();
+        DBManager::instance()->getMoreHistory("", afterLinkId, links.last().sortKey());
+        QVERIFY(moreHistoryAvailableSpy.wait(5000));
+        QList<QVariant> arguments = moreHistoryAvailableSpy.takeFirst();
+        QCOMPARE(arguments.at(0).toString(), QString(""));
+        QCOMPARE(arguments.at(1).toInt(), afterLinkId);
+        QList<Link> page = arguments.at(2).value<QList<Link> >();
+        QCOMPARE(page.count(), expected);
+        for (const Link &link : page) {
+            QVERIFY(!urls.contains(link.url()));
+            urls.insert(link.url());
+        }
+        if (page.isEmpty()) {
+            break;
+        }
+        links = page;
+    }
+
+    QCOMPARE(urls.count(), entries);
+}
+
+void tst_dbmanager::expireHistory()
+{
+    {
+        DBWorker worker;
+        worker.init();
+
+        QSqlDatabase db = QSqlDatabase::database();
+        QVERIFY(db.transaction());
+        QSqlQuery urlQuery(db);
+        QVERIFY(urlQuery.prepare("INSERT INTO url (url, hash) VALUES (?, ?);"));
+        QSqlQuery query(db);
+        QVERIFY(query.prepare("INSERT INTO browser_history (url_id, title, date) VALUES (last_insert_rowid(), ?, ?);"));
+        for (int i = 0; i < 1000; ++i) {
+            const QString url = QString("http://example.com/%1").arg(i);
+            urlQuery.bindValue(0, url);
+            urlQuery.bindValue(1, DBWorker::urlHash(url));
+            QVERIFY(urlQuery.exec());
+            query.bindValue(0, QString("Test title %1 ").arg(i).repeated(50));
+            query.bindValue(1, i);
+            QVERIFY(query.exec());
+        }
+        QVERIFY(db.commit());
+
+        // Nothing is expired at startup
+        QVERIFY(query.exec("SELECT COUNT(*) FROM browser_history;"));
+        QVERIFY(query.first());
+        QCOMPARE(query.value(0).toInt(), 1000);
+
+        // Entry limit, the oldest entries go first
+        worker.setHistoryLimits(250, 0);
+        for (int i = 0; i < 20; ++i) {
+            worker.expireHistory();
+        }
+        worker.flush();
+        QVERIFY(query.exec("SELECT COUNT(*), MIN(date) FROM browser_history;"));
+        QVERIFY(query.first());
+        QCOMPARE(query.value(0).toInt(), 250);
+        QCOMPARE(query.value(1).toInt(), 750);
+        QVERIFY(query.exec("SELECT COUNT(*) FROM url;"));
+        QVERIFY(query.first());
+        QCOMPARE(query.value(0).toInt(), 250);
+
+        // Byte budget of half the storage taken by the history
+        qint64 budget = historyBytes(worker) / 2;
+        worker.setHistoryLimits(0, budget);
+        for (int i = 0; i < 20; ++i) {
+            worker.expireHistory();
+        }
+        worker.flush();
+        QVERIFY(historyBytes(worker) <= budget);
+        QVERIFY(query.exec("SELECT COUNT(*), MIN(date) FROM browser_history;"));
+        QVERIFY(query.first());
+        QVERIFY(query.value(0).toInt() < 250);
+        QVERIFY(query.value(0).toInt() > 0);
+        QCOMPARE(query.value(1).toInt(), 1000 - query.value(0).toInt());
+    }
+    QSqlDatabase::removeDatabase(QSqlDatabase::defaultConnection);
+}
+
+void tst_dbmanager::expireHistoryKeepsTabs()
+{
+    {
+        DBWorker worker;
+        worker.init();
+
+        QSqlDatabase db = QSqlDatabase::database();
+        QVERIFY(db.transaction());
+        QSqlQuery urlQuery(db);
+        QVERIFY(urlQuery.prepare("INSERT INTO url (url, hash) VALUES (?, ?);"));
+        QSqlQuery query(db);
+        QVERIFY(query.prepare("INSERT INTO browser_history (url_id, title, date) VALUES (last_insert_rowid(), ?, ?);"));
+        for (int i = 0; i < 50; ++i) {
+            const QString url = QString("http://example.com/%1").arg(i);
+            urlQuery.bindValue(0, url);
+            urlQuery.bindValue(1, DBWorker::urlHash(url));
+            QVERIFY(urlQuery.exec());
+            query.bindValue(0, QString("Test title %1").arg(i));
+            query.bindValue(1, i);
+            QVERIFY(query.exec());
+        }
+
+        // Navigation history of tabs, much larger than the history
+        QSqlQuery linkQuery(db);
+        QVERIFY(linkQuery.prepare("INSERT INTO link (url_id, title, thumb_path) VALUES (?, ?, ?);"));
+        QSqlQuery tabHistoryQuery(db);
+        QVERIFY(tabHistoryQuery.prepare("INSERT INTO tab_history (tab_id, link_id, date) VALUES (?, last_insert_rowid(), ?);"));
+        for (int i = 0; i < 2000; ++i) {
+            linkQuery.bindValue(0, i % 50 + 1);
+            linkQuery.bindValue(1, QString("Tab title %1 ").arg(i).repeated(20));
+            linkQuery.bindValue(2, QString("/tmp/thumbnail-%1.png").arg(i));
+            QVERIFY(linkQuery.exec());
+            tabHistoryQuery.bindValue(0, i / 100 + 1);
+            tabHistoryQuery.bindValue(1, i);
+            QVERIFY(tabHistoryQuery.exec());
+        }
+        QVERIFY(db.commit());
+
+        // Tabs alone exceed the budget, the history fits in it
+        QVERIFY(query.exec("SELECT ((SELECT page_count FROM pragma_page_count()) - "
+                           "(SELECT freelist_count FROM pragma_freelist_count())) * "
+                           "(SELECT page_size FROM pragma_page_size());"));
+        QVERIFY(query.first());
+        qint64 usedBytes = query.value(0).toLongLong();
+        qint64 budget = historyBytes(worker) * 2;
+        QVERIFY(usedBytes > 2 * budget);
+
+        worker.setHistoryLimits(0, budget);
+        for (int i = 0; i < 20; ++i) {
+            worker.expireHistory();
+        }
+        worker.flush();
+        QVERIFY(query.exec("SELECT COUNT(*) FROM browser_history;"));
+        QVERIFY(query.first());
+        QCOMPARE(query.value(0).toInt(), 50);
+        QVERIFY(query.exec("SELECT COUNT(*) FROM tab_history;"));
+        QVERIFY(query.first());
+        QCOMPARE(query.value(0).toInt(), 2000);
+    }
+    QSqlDatabase::removeDatabase(QSqlDatabase::defaultConnection);
+}
+
+void tst_dbmanager::maintenance()
+{
+    {
+        DBWorker worker;
+        worker.init();
+
+        // Leave free pages behind
+        QSqlDatabase db = QSqlDatabase::database();
+        QVERIFY(db.transaction());
+        QSqlQuery urlQuery(db);
+        QVERIFY(urlQuery.prepare("INSERT INTO url (url, hash) VALUES (?, ?);"));
+        QSqlQuery query(db);
+        QVERIFY(query.prepare("INSERT INTO browser_history (url_id, title, date) VALUES (last_insert_rowid(), ?, ?);"));
+        for (int i = 0; i < 2000; ++i) {
+            const QString url = QString("http://example.com/%1").arg(i);
+            urlQuery.bindValue(0, url);
+            urlQuery.bindValue(1, DBWorker::urlHash(url));
+            QVERIFY(urlQuery.exec());
+            query.bindValue(0, QString("Test title %1 ").arg(i).repeated(20));
+            query.bindValue(1, i);
+            QVERIFY(query.exec());
+        }
+        QVERIFY(db.commit());
+        worker.clearHistory();
+        worker.flush();
+
+        QVERIFY(query.exec("PRAGMA auto_vacuum;"));
+        QVERIFY(query.first());
+        QCOMPARE(query.value(0).toInt(), 2);
+        QVERIFY(query.exec("PRAGMA freelist_count;"));
+        QVERIFY(query.first());
+        QVERIFY(query.value(0).toInt() > 0);
+        query.finish();
+
+        QSignalSpy statisticsSpy(&worker, SIGNAL(statisticsAvailable(QVariantMap)));
+
+        // Nothing happens while the browser is in the foreground
+        worker.maintain();
+        worker.getStatistics();
+        QVariantMap maintenance = statisticsSpy.last().at(0).toMap().value("maintenance").toMap();
+        QCOMPARE(maintenance.value("runs").toInt(), 0);
+        QCOMPARE(maintenance.value("running").toBool(), false);
+
+        worker.setMaintenanceAllowed(true);
+        for (int i = 0; i < 100; ++i) {
+            worker.maintain();
+            worker.getStatistics();
+            maintenance = statisticsSpy.last().at(0).toMap().value("maintenance").toMap();
+            if (!maintenance.value("running").toBool()) {
+                break;
+            }
+        }
+        QCOMPARE(maintenance.value("runs").toInt(), 1);
+        QVERIFY(maintenance.value("reclaimedBytes").toLongLong() > 0);
+
+        QVERIFY(query.exec("PRAGMA freelist_count;"));
+        QVERIFY(query.first());
+        QCOMPARE(query.value(0).toInt(), 0);
+        QVERIFY(query.exec("SELECT COUNT(*) FROM sqlite_master WHERE name = 'sqlite_stat1';"));
+        QVERIFY(query.first());
+        QCOMPARE(query.value(0).toInt(), 1);
+        query.finish();
+
+        // Not repeated right away
+        worker.maintain();
+        worker.getStatistics();
+        maintenance = statisticsSpy.last().at(0).toMap().value("maintenance").toMap();
+        QCOMPARE(maintenance.value("runs").toInt(), 1);
+        worker.setMaintenanceAllowed(false);
+    }
+    QSqlDatabase::removeDatabase(QSqlDatabase::defaultConnection);
+}
+
+void tst_dbmanager::benchmarkNavigateTo_data()
+{
+    QTest::addColumn<bool>("statementCache");
+
+    QTest::newRow("uncached") << false;
+    QTest::newRow("cached") << true;
+}
+
+void tst_dbmanager::benchmarkNavigateTo()
+{
+    QFETCH(bool, statementCache);
+
+    {
+        DBWorker worker;
+        worker.setStatementCacheEnabled(statementCache);
+        worker.init();
+        worker.createTab(Tab(1, "http://example.com", "Test title", ""));
+
+        int i = 0;
+        QBENCHMARK {
+            worker.navigateTo(1, QString("http://example.com/%1").arg(++i), "Test title", "");
+        }
+        worker.flush();
+    }
+    QSqlDatabase::removeDatabase(QSqlDatabase::defaultConnection);
+}
+
+void tst_dbmanager::benchmarkGetHistory_data()
+{
+    QTest::addColumn<bool>("statementCache");
+
+    QTest::newRow("uncached") << false;
+    QTest::newRow("cached") << true;
+}
+
+void tst_dbmanager::benchmarkGetHistory()
+{
+    QFETCH(bool, statementCache);
+
+    {
+        DBWorker worker;
+        worker.setStatementCacheEnabled(statementCache);
+        worker.init();
+        worker.createTab(Tab(1, "http://example.com", "Test title", ""));
+        for (int i = 0; i < 200; ++i) {
+            worker.navigateTo(1, QString("http://example.com/%1").arg(i), QString("Test title %1").arg(i), "");
+        }
+        worker.flush();
+
+        QBENCHMARK {
+            worker.getHistory("title 1");
+        }
+    }
+    QSqlDatabase::removeDatabase(QSqlDatabase::defaultConnection);
+}
+
+void tst_dbmanager::benchmarkWriteLatency_data()
+{
+    QTest::addColumn<bool>("wal");
+
+    QTest::newRow("rollback_journal") << false;
+    QTest::newRow("wal") << true;
+}
+
+void tst_dbmanager::benchmarkWriteLatency()
+{
+    QFETCH(bool, wal);
+
+    {
+        DBWorker worker;
+        worker.init();
+        worker.createTab(Tab(1, "http://example.com", "Test title", ""));
+        worker.flush();
+
+        if (!wal) {
+            // Settings used before switching to write-ahead logging
+            QSqlQuery query(QSqlDatabase::database());
+            QVERIFY(query.exec("PRAGMA journal_mode = DELETE;"));
+            QVERIFY(query.exec("PRAGMA synchronous = FULL;"));
+        }
+
+        // One committed navigation per iteration
+        int i = 0;
+        QBENCHMARK {
+            worker.navigateTo(1, QString("http://example.com/%1").arg(++i), "Test title", "");
+            worker.flush();
+        }
+    }
+    QSqlDatabase::removeDatabase(QSqlDatabase::defaultConnection);
+}
+
+void tst_dbmanager::benchmarkSearchHistory_data()
+{
+    QTest::addColumn<int>("entries");
+
+    QTest::newRow("2k") << 2000;
+    QTest::newRow("20k") << 20000;
+    QTest::newRow("100k") << 100000;
+}
+
+void tst_dbmanager::benchmarkSearchHistory()
+{
+    QFETCH(int, entries);
+
+    {
+        DBWorker worker;
+        worker.init();
+
+        QSqlDatabase db = QSqlDatabase::database();
+        QVERIFY(db.transaction());
+        QSqlQuery urlQuery(db);
+        QVERIFY(urlQuery.prepare("INSERT INTO url (url, hash) VALUES (?, ?);"));
+        QSqlQuery query(db);
+        QVERIFY(query.prepare("INSERT INTO browser_history (url_id, title, date) VALUES (last_insert_rowid(), ?, ?);"));
+        for (int i = 0; i < entries; ++i) {
+            const QString url = QString("http://site%1.example.com/page/%2").arg(i % 500).arg(i);
+            urlQuery.bindValue(0, url);
+            urlQuery.bindValue(1, DBWorker::urlHash(url));
+            QVERIFY(urlQuery.exec());
+            query.bindValue(0, QString("Page %1 of site %2").arg(i).arg(i % 500));
+            query.bindValue(1, i);
+            QVERIFY(query.exec());
+        }
+        QVERIFY(db.commit());
+
+        // Typing a url, one query per keystroke
+        QBENCHMARK {
+            worker.getHistory("s");
+            worker.getHistory("si");
+            worker.getHistory("site");
+            worker.getHistory("site42");
+            worker.getHistory("site42 page");
+        }
+    }
+    QSqlDatabase::removeDatabase(QSqlDatabase::defaultConnection);
+}
+
+void tst_dbmanager::benchmarkStartup_data()
+{
+    QTest::addColumn<int>("entries");
+
+    QTest::newRow("2k") << 2000;
+    QTest::newRow("100k") << 100000;
+}
+
+void tst_dbmanager::benchmarkStartup()
+{
+    QFETCH(int, entries);
+
+    {
+        DBWorker worker;
+        worker.init();
+
+        QSqlDatabase db = QSqlDatabase::database();
+        QVERIFY(db.transaction());
+        QSqlQuery urlQuery(db);
+        QVERIFY(urlQuery.prepare("INSERT INTO url (url, hash) VALUES (?, ?);"));
+        QSqlQuery query(db);
+        QVERIFY(query.prepare("INSERT INTO browser_history (url_id, title, date) VALUES (last_insert_rowid(), ?, ?);"));
+        for (int i = 0; i < entries; ++i) {
+            const QString url = QString("http://site%1.example.com/page/%2").arg(i % 500).arg(i);
+            urlQuery.bindValue(0, url);
+            urlQuery.bindValue(1, DBWorker::urlHash(url));
+            QVERIFY(urlQuery.exec());
+            query.bindValue(0, QString("Page %1 of site %2").arg(i).arg(i % 500));
+            query.bindValue(1, i);
+            QVERIFY(query.exec());
+        }
+        QVERIFY(db.commit());
+    }
+    QSqlDatabase::removeDatabase(QSqlDatabase::defaultConnection);
+
+    // Time the caller of DBManager is held at startup
+    QBENCHMARK_ONCE {
+        DBManager::instance();
+    }
+    waitForLoaded();
 }
 
 QTEST_MAIN(tst_dbmanager)
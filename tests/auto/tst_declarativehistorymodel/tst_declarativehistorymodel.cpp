@@ -19,6 +19,7 @@
 #include "testobject.h"
 #include "dbmanager.h"
 #include "browserpaths.h"
+#include "sessionsnapshot.h"
 
 struct TabTuple {
     TabTuple(QString url, QString title) : url(url), title(title) {}
@@ -87,7 +88,7 @@ void tst_declarativehistorymodel::initTestCase()
 
 void tst_declarativehistorymodel::init()
 {
-    tabModel = new PersistentTabModel(DBManager::instance()->getMaxTabId() + 1);
+    tabModel = new PersistentTabModel(DBManager::instance()->getMaxTabId().result() + 1);
     historyModel = new DeclarativeHistoryModel;
 
     QVERIFY(tabModel);
@@ -321,6 +322,7 @@ void tst_declarativehistorymodel::cleanup()
     delete DBManager::instance();
     QFile dbFile(dbFileName);
     QVERIFY(dbFile.remove());
+    QVERIFY(SessionSnapshot::remove());
 }
 
 void tst_declarativehistorymodel::addTabs(const QList<TabTuple> &tabs)
@@ -17,6 +17,7 @@
 #include "declarativewebpage.h"
 #include "declarativewebcontainer.h"
 #include "browserpaths.h"
+#include "sessionsnapshot.h"
 
 using ::testing::Return;
 
@@ -59,12 +60,17 @@ private slots:
     void updateThumbnailPath();
     void onUrlChanged();
     void onTitleChanged();
+    void coalesceTitles();
     void nextActiveTabIndex();
     void roleNames();
     void data_data();
     void data();
     void setUnloaded();
     void newTab();
+    void restoreSnapshot();
+    void reconcileSnapshot();
+    void mergeSnapshot();
+    void corruptedSnapshot();
 
 private:
     void addThreeTabs();
@@ -83,11 +89,12 @@ void tst_persistenttabmodel::initTestCase()
             .arg(QLatin1String(DB_NAME));
     QFile dbFile(mDbFile);
     dbFile.remove();
+    SessionSnapshot::remove();
 }
 
 void tst_persistenttabmodel::init()
 {
-    int nextTabId = DBManager::instance()->getMaxTabId() + 1;
+    int nextTabId = DBManager::instance()->getMaxTabId().result() + 1;
     tabModel = new PersistentTabModel(nextTabId);
 
     if (!tabModel->loaded()) {
@@ -104,6 +111,7 @@ void tst_persistenttabmodel::cleanup()
     delete DBManager::instance();
     QFile dbFile(mDbFile);
     QVERIFY(dbFile.remove());
+    QVERIFY(SessionSnapshot::remove());
 }
 
 
@@ -541,6 +549,58 @@ void tst_persistenttabmodel::onTitleChanged()
     QCOMPARE(dataChangedSpy.count(), 1);
 }
 
+void tst_persistenttabmodel::coalesceTitles()
+{
+    tabModel->addTab("http://example.com", "initial title", 0);
+    // The active tab setting would be written meanwhile
+    DBManager::instance()->flushSettings().waitForFinished();
+
+    QSignalSpy statisticsSpy(DBManager::instance(), SIGNAL(statisticsAvailable(QVariantMap)));
+    DBManager::instance()->getStatistics();
+    QVERIFY(statisticsSpy.wait());
+    QVariantMap transactions = statisticsSpy.at(0).at(0).toMap().value("transactions").toMap();
+    const int writesBefore = transactions.value("writeCount").toInt() + transactions.value("pendingWrites").toInt();
+
+    DeclarativeWebPage mockPage;
+    connect(&mockPage, &DeclarativeWebPage::titleChanged, tabModel, &PersistentTabModel::onTitleChanged);
+    QSignalSpy dataChangedSpy(tabModel, SIGNAL(dataChanged(QModelIndex, QModelIndex, QVector<int>)));
+    QSignalSpy titleChangedSpy(DBManager::instance(), SIGNAL(titleChanged(QString,QString)));
+
+    // A page changing its title ten times while loading
+    EXPECT_CALL(mockPage, tabId()).WillRepeatedly(Return(1));
+    EXPECT_CALL(mockPage, url()).WillRepeatedly(Return(QUrl("http://example.com")));
+    for (int i = 1; i <= 10; ++i) {
+        EXPECT_CALL(mockPage, title()).WillOnce(Return(QString("Loading %1").arg(i)));
+        emit mockPage.titleChanged();
+    }
+
+    // The model follows every change, the database gets the last one once
+    QCOMPARE(dataChangedSpy.count(), 10);
+    QCOMPARE(tabModel->activeTab().title(), QString("Loading 10"));
+    QVERIFY(titleChangedSpy.wait());
+    QCOMPARE(titleChangedSpy.count(), 1);
+    QCOMPARE(titleChangedSpy.at(0).at(1).toString(), QString("Loading 10"));
+
+    DBManager::instance()->getStatistics();
+    QVERIFY(statisticsSpy.wait());
+    transactions = statisticsSpy.at(1).at(0).toMap().value("transactions").toMap();
+    const int coalescedWrites = transactions.value("writeCount").toInt() + transactions.value("pendingWrites").toInt();
+    QCOMPARE(coalescedWrites, writesBefore + 1);
+
+    // Baseline: the same titles written one by one
+    for (int i = 1; i <= 10; ++i) {
+        DBManager::instance()->updateTitle(1, "http://example.com", QString("Direct %1").arg(i));
+    }
+    while (titleChangedSpy.count() < 11) {
+        QVERIFY(titleChangedSpy.wait());
+    }
+    DBManager::instance()->getStatistics();
+    QVERIFY(statisticsSpy.wait());
+    transactions = statisticsSpy.at(2).at(0).toMap().value("transactions").toMap();
+    QCOMPARE(transactions.value("writeCount").toInt() + transactions.value("pendingWrites").toInt(),
+             coalescedWrites + 10);
+}
+
 void tst_persistenttabmodel::nextActiveTabIndex()
 {
     DeclarativeWebContainer container;
@@ -616,6 +676,121 @@ void tst_persistenttabmodel::newTab()
     QCOMPARE(tabModel->waitingForNewTab(), true);
 }
 
+void tst_persistenttabmodel::restoreSnapshot()
+{
+    addThreeTabs();
+    tabModel->activateTabById(2);
+
+    // Destroying the model saves the pending snapshot, wait until the
+    // writer has done it.
+    delete tabModel;
+    DBManager::instance()->getMaxTabId().waitForFinished();
+
+    // Tabs are available right away, without a database round trip.
+    tabModel = new PersistentTabModel(1);
+    QVERIFY(tabModel->loaded());
+    QCOMPARE(tabModel->count(), 3);
+    QCOMPARE(tabModel->activeTabId(), 2);
+    QCOMPARE(tabModel->tabs().at(0).url(), QString("http://example.com"));
+    QCOMPARE(tabModel->tabs().at(1).title(), QString("Test title2"));
+    QCOMPARE(tabModel->nextTabId(), 4);
+
+    // The database agrees with the snapshot, reconciling keeps the model.
+    QSignalSpy tabsAvailableSpy(DBManager::instance(), SIGNAL(tabsAvailable(QList<Tab>)));
+    QVERIFY(tabsAvailableSpy.wait());
+    QCOMPARE(tabModel->count(), 3);
+    QCOMPARE(tabModel->activeTabId(), 2);
+}
+
+void tst_persistenttabmodel::reconcileSnapshot()
+{
+    addThreeTabs();
+    delete tabModel;
+    DBManager::instance()->getMaxTabId().waitForFinished();
+
+    // Snapshot of a session the database does not know
+    QList<Tab> staleTabs;
+    staleTabs << Tab(42, "http://stale.example.com", "Stale", "");
+    QVERIFY(SessionSnapshot::save(staleTabs, 42));
+
+    tabModel = new PersistentTabModel(1);
+    QVERIFY(tabModel->loaded());
+    QCOMPARE(tabModel->count(), 1);
+    QCOMPARE(tabModel->activeTabId(), 42);
+
+    QSignalSpy activeTabChangedSpy(tabModel, SIGNAL(activeTabChanged(int)));
+    QSignalSpy tabsAvailableSpy(DBManager::instance(), SIGNAL(tabsAvailable(QList<Tab>)));
+    QVERIFY(tabsAvailableSpy.wait());
+    QCOMPARE(tabModel->count(), 3);
+    QVERIFY(!tabModel->contains(42));
+    QCOMPARE(activeTabChangedSpy.count(), 1);
+    QCOMPARE(tabModel->nextTabId(), 4);
+
+    // The stale snapshot gets replaced
+    delete tabModel;
+    DBManager::instance()->getMaxTabId().waitForFinished();
+    QList<Tab> tabs;
+    int activeTabId = 0;
+    QVERIFY(SessionSnapshot::load(&tabs, &activeTabId));
+    QCOMPARE(tabs.count(), 3);
+
+    tabModel = new PersistentTabModel(1);
+}
+
+void tst_persistenttabmodel::mergeSnapshot()
+{
+    addThreeTabs();
+    QList<Tab> snapshotTabs = tabModel->tabs().mid(0, 2);
+    delete tabModel;
+    DBManager::instance()->getMaxTabId().waitForFinished();
+
+    // Snapshot saved before the third tab was opened
+    QVERIFY(SessionSnapshot::save(snapshotTabs, 1));
+    tabModel = new PersistentTabModel(1);
+    QCOMPARE(tabModel->count(), 2);
+
+    // Closed before the database reports its tabs
+    tabModel->removeTabById(2, false);
+    QCOMPARE(tabModel->count(), 1);
+
+    QSignalSpy tabsAvailableSpy(DBManager::instance(), SIGNAL(tabsAvailable(QList<Tab>)));
+    QVERIFY(tabsAvailableSpy.wait());
+    QCOMPARE(tabModel->count(), 2);
+    QVERIFY(tabModel->contains(1));
+    QVERIFY(!tabModel->contains(2));
+    QVERIFY(tabModel->contains(3));
+    QCOMPARE(tabModel->activeTabId(), 1);
+    QCOMPARE(tabModel->nextTabId(), 4);
+}
+
+void tst_persistenttabmodel::corruptedSnapshot()
+{
+    delete tabModel;
+    DBManager::instance()->getMaxTabId().waitForFinished();
+
+    QList<Tab> tabs;
+    tabs << Tab(1, "http://example.com", "Test title1", "");
+    QVERIFY(SessionSnapshot::save(tabs, 1));
+
+    QFile snapshot(SessionSnapshot::path());
+    QVERIFY(snapshot.open(QIODevice::ReadWrite));
+    QByteArray data = snapshot.readAll();
+    data[data.size() - 1] = ~data.at(data.size() - 1);
+    QVERIFY(snapshot.seek(0));
+    QCOMPARE(snapshot.write(data), qint64(data.size()));
+    snapshot.close();
+
+    int activeTabId = 0;
+    QVERIFY(!SessionSnapshot::load(&tabs, &activeTabId));
+
+    // The model falls back to waiting for the database
+    tabModel = new PersistentTabModel(1);
+    QVERIFY(!tabModel->loaded());
+    QSignalSpy loadedSpy(tabModel, SIGNAL(loadedChanged()));
+    QVERIFY(loadedSpy.wait());
+    QCOMPARE(tabModel->count(), 0);
+}
+
 void tst_persistenttabmodel::addThreeTabs()
 {
     QList<QString> urls, titles;
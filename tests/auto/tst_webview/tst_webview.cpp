@@ -22,6 +22,7 @@
 #include "declarativewebutils.h"
 #include "webpages.h"
 #include "browserpaths.h"
+#include "sessionsnapshot.h"
 #include "testobject.h"
 
 class tst_webview : public TestObject
@@ -767,6 +768,7 @@ void tst_webview::cleanupTestCase()
             .arg(QLatin1String(DB_NAME));
     QFile dbFile(dbFileName);
     QVERIFY(dbFile.remove());
+    QVERIFY(SessionSnapshot::remove());
     SailfishOS::WebEngine::instance()->stopEmbedding();
 }
 
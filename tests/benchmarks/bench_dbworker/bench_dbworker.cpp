@@ -0,0 +1,532 @@
+/****************************************************************************
+**
+** Copyright (c) 2026 Jolla Ltd.
+**
+****************************************************************************/
+
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <QtTest>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+
+#include "dbworker.h"
+#include "browserpaths.h"
+
+// Results are written to this file, override with BENCH_DBWORKER_OUTPUT
+#define DEFAULT_OUTPUT_FILE "bench_dbworker.json"
+
+// Seconds between generated history entries
+#define HISTORY_DATE_STEP 60
+#define HISTORY_DATE_BASE 1600000000
+#define HOST_COUNT 500
+
+/**
+ * Fills the browser database with synthetic tabs and history.
+ *
+ * The same parameters always produce the same database: urls, titles and
+ * dates come from a fixed seed instead of the clock or qrand().
+ */
+class DataGenerator
+{
+public:
+    explicit DataGenerator(quint32 seed = 1)
+        : m_state(seed)
+    {
+    }
+
+    // tabs tabs with navigations entries each, on top of historyEntries
+    // entries of browser history
+    bool generate(int tabs, int historyEntries, int navigations);
+
+    static QString historyUrl(int index);
+
+private:
+    quint32 next();
+    QString title(int index);
+
+    quint32 m_state;
+};
+
+static const char * const words[] = {
+    "sailfish", "browser", "jolla", "news", "weather", "forum", "wiki", "mail",
+    "maps", "music", "video", "photos", "travel", "sports", "recipes", "games"
+};
+static const int wordCount = sizeof(words) / sizeof(*words);
+
+quint32 DataGenerator::next()
+{
+    // Numerical Recipes LCG, plenty for picking test data
+    m_state = m_state * 1664525u + 1013904223u;
+    return m_state >> 8;
+}
+
+QString DataGenerator::historyUrl(int index)
+{
+    return QString("http://site%1.example.com/%2/%3")
+            .arg(index % HOST_COUNT)
+            .arg(QLatin1String(words[index % wordCount]))
+            .arg(index);
+}
+
+QString DataGenerator::title(int index)
+{
+    return QString("%1 %2 page %3")
+            .arg(QLatin1String(words[next() % wordCount]))
+            .arg(QLatin1String(words[next() % wordCount]))
+            .arg(index);
+}
+
+bool DataGenerator::generate(int tabs, int historyEntries, int navigations)
+{
+    QSqlDatabase db = QSqlDatabase::database();
+    if (!db.transaction()) {
+        return false;
+    }
+
+    QSqlQuery urlQuery(db);
+    QSqlQuery historyQuery(db);
+    if (!urlQuery.prepare("INSERT INTO url (url, hash) VALUES (?, ?);")
+            || !historyQuery.prepare("INSERT INTO browser_history (url_id, title, date, visited_count, frecency) "
+                                     "VALUES (last_insert_rowid(), ?, ?, ?, ?);")) {
+        return false;
+    }
+
+    for (int i = 0; i < historyEntries; ++i) {
+        int visits = 1 + next() % 10;
+        urlQuery.bindValue(0, historyUrl(i));
+        urlQuery.bindValue(1, DBWorker::urlHash(historyUrl(i)));
+        historyQuery.bindValue(0, title(i));
+        historyQuery.bindValue(1, HISTORY_DATE_BASE + i * HISTORY_DATE_STEP);
+        historyQuery.bindValue(2, visits);
+        historyQuery.bindValue(3, visits * (1.0 + qreal(i) / qMax(historyEntries, 1)));
+        if (!urlQuery.exec() || !historyQuery.exec()) {
+            return false;
+        }
+    }
+
+    // Tab navigations point to history entries, or to urls of their own
+    // when there is no history.
+    QSqlQuery linkQuery(db);
+    QSqlQuery tabHistoryQuery(db);
+    QSqlQuery tabQuery(db);
+    if (!linkQuery.prepare("INSERT INTO link (url_id, title, thumb_path) VALUES (?, ?, '');")
+            || !tabHistoryQuery.prepare("INSERT INTO tab_history (tab_id, link_id, date) VALUES (?, last_insert_rowid(), ?);")
+            || !tabQuery.prepare("INSERT INTO tab (tab_id, tab_history_id) VALUES (?, last_insert_rowid());")) {
+        return false;
+    }
+
+    for (int tabId = 1; tabId <= tabs; ++tabId) {
+        for (int i = 0; i < navigations; ++i) {
+            int urlId;
+            if (historyEntries > 0) {
+                urlId = 1 + next() % historyEntries;
+            } else {
+                const QString url = QString("http://tab%1.example.com/%2").arg(tabId).arg(i);
+                urlQuery.bindValue(0, url);
+                urlQuery.bindValue(1, DBWorker::urlHash(url));
+                if (!urlQuery.exec()) {
+                    return false;
+                }
+                urlId = urlQuery.lastInsertId().toInt();
+            }
+            linkQuery.bindValue(0, urlId);
+            linkQuery.bindValue(1, title(i));
+            tabHistoryQuery.bindValue(0, tabId);
+            tabHistoryQuery.bindValue(1, HISTORY_DATE_BASE + i * HISTORY_DATE_STEP);
+            if (!linkQuery.exec() || !tabHistoryQuery.exec()) {
+                return false;
+            }
+        }
+        // The last navigation is the current one
+        tabQuery.bindValue(0, tabId);
+        if (!tabQuery.exec()) {
+            return false;
+        }
+    }
+
+    return db.commit();
+}
+
+class bench_dbworker : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanup();
+    void cleanupTestCase();
+
+    void navigateTo_data();
+    void navigateTo();
+    void navigateToLongUrl_data();
+    void navigateToLongUrl();
+    void getHistory_data();
+    void getHistory();
+    void getHistoryFiltered_data();
+    void getHistoryFiltered();
+    void getAllTabs_data();
+    void getAllTabs();
+    void getTabHistory_data();
+    void getTabHistory();
+    void removeTab_data();
+    void removeTab();
+    void clearHistory_data();
+    void clearHistory();
+    void startup_data();
+    void startup();
+
+private:
+    void addDatasets();
+    bool generateDatabase();
+    bool createDatabase(DBWorker *worker);
+    void record(qint64 nsecs, int iterations, const QJsonObject &extra = QJsonObject());
+    static QJsonObject urlIndexSize();
+
+    QString mDbFile;
+    QJsonArray mResults;
+};
+
+void bench_dbworker::initTestCase()
+{
+    mDbFile = QString("%1/%2")
+            .arg(BrowserPaths::dataLocation())
+            .arg(QLatin1String(DB_NAME));
+    QFile::remove(mDbFile);
+}
+
+void bench_dbworker::cleanup()
+{
+    QSqlDatabase::removeDatabase(QSqlDatabase::defaultConnection);
+    QFile::remove(mDbFile);
+    QFile::remove(mDbFile + "-wal");
+    QFile::remove(mDbFile + "-shm");
+}
+
+void bench_dbworker::cleanupTestCase()
+{
+    QString output = QString::fromLocal8Bit(qgetenv("BENCH_DBWORKER_OUTPUT"));
+    if (output.isEmpty()) {
+        output = QLatin1String(DEFAULT_OUTPUT_FILE);
+    }
+
+    QJsonObject report;
+    report.insert(QStringLiteral("suite"), QStringLiteral("bench_dbworker"));
+    report.insert(QStringLiteral("timestamp"), QDateTime::currentDateTimeUtc().toString(Qt::ISODate));
+    report.insert(QStringLiteral("results"), mResults);
+
+    QFile file(output);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Cannot write benchmark results to" << output;
+        return;
+    }
+    file.write(QJsonDocument(report).toJson());
+    qDebug() << "Benchmark results written to" << QFileInfo(file).absoluteFilePath();
+}
+
+// Tabs, history entries and navigations per tab
+void bench_dbworker::addDatasets()
+{
+    QTest::addColumn<int>("tabs");
+    QTest::addColumn<int>("historyEntries");
+    QTest::addColumn<int>("navigations");
+
+    QTest::newRow("small") << 5 << 1000 << 10;
+    QTest::newRow("medium") << 20 << 20000 << 50;
+    QTest::newRow("large") << 50 << 100000 << 100;
+}
+
+bool bench_dbworker::generateDatabase()
+{
+    QFETCH(int, tabs);
+    QFETCH(int, historyEntries);
+    QFETCH(int, navigations);
+
+    bool ok;
+    {
+        // Creates the schema
+        DBWorker worker;
+        worker.init();
+        DataGenerator generator;
+        ok = generator.generate(tabs, historyEntries, navigations);
+    }
+    QSqlDatabase::removeDatabase(QSqlDatabase::defaultConnection);
+    return ok;
+}
+
+// Opens worker on a generated database, so that it starts from the data
+// like it would at startup.
+bool bench_dbworker::createDatabase(DBWorker *worker)
+{
+    if (!generateDatabase()) {
+        return false;
+    }
+    worker->init();
+    return true;
+}
+
+// Wall clock time of all iterations of a QBENCHMARK block, stored for the
+// JSON report next to the parameters of the data set.
+void bench_dbworker::record(qint64 nsecs, int iterations, const QJsonObject &extra)
+{
+    QFETCH(int, tabs);
+    QFETCH(int, historyEntries);
+    QFETCH(int, navigations);
+
+    QJsonObject result;
+    result.insert(QStringLiteral("benchmark"), QLatin1String(QTest::currentTestFunction()));
+    result.insert(QStringLiteral("dataset"), QLatin1String(QTest::currentDataTag()));
+    result.insert(QStringLiteral("tabs"), tabs);
+    result.insert(QStringLiteral("historyEntries"), historyEntries);
+    result.insert(QStringLiteral("navigations"), navigations);
+    result.insert(QStringLiteral("iterations"), iterations);
+    result.insert(QStringLiteral("totalNsecs"), double(nsecs));
+    result.insert(QStringLiteral("nsecsPerIteration"), iterations > 0 ? double(nsecs) / iterations : 0.0);
+    for (QJsonObject::const_iterator it = extra.constBegin(); it != extra.constEnd(); ++it) {
+        result.insert(it.key(), it.value());
+    }
+    mResults.append(result);
+}
+
+// Bytes taken by the url table and its indices, needs SQLite built with the
+// dbstat virtual table. Empty otherwise.
+QJsonObject bench_dbworker::urlIndexSize()
+{
+    QJsonObject sizes;
+    QSqlQuery query(QSqlDatabase::database());
+    if (!query.exec("SELECT name, SUM(pgsize) FROM dbstat WHERE name = 'url' "
+                    "OR name IN (SELECT name FROM sqlite_master WHERE type = 'index' AND tbl_name = 'url') "
+                    "GROUP BY name;")) {
+        return sizes;
+    }
+    while (query.next()) {
+        sizes.insert(query.value(0).toString() + QLatin1String("Bytes"), double(query.value(1).toLongLong()));
+    }
+    return sizes;
+}
+
+void bench_dbworker::navigateTo_data()
+{
+    addDatasets();
+}
+
+void bench_dbworker::navigateTo()
+{
+    {
+        DBWorker worker;
+        QVERIFY(createDatabase(&worker));
+
+        // One committed navigation per iteration
+        int iterations = 0;
+        QElapsedTimer timer;
+        timer.start();
+        QBENCHMARK {
+            worker.navigateTo(1, QString("http://navigation.example.com/%1").arg(iterations), "Navigation", "");
+            worker.flush();
+            ++iterations;
+        }
+        record(timer.nsecsElapsed(), iterations);
+    }
+}
+
+void bench_dbworker::navigateToLongUrl_data()
+{
+    addDatasets();
+}
+
+// New urls with tracking parameters, hundreds of bytes each
+void bench_dbworker::navigateToLongUrl()
+{
+    {
+        DBWorker worker;
+        QVERIFY(createDatabase(&worker));
+
+        const QString tracking = QString("&utm_source=newsletter&utm_medium=email&utm_campaign=%1"
+                                         "&fbclid=IwAR%2&gclid=Cj0KCQiA%3").arg(QString(40, QLatin1Char('x')))
+                .arg(QString(80, QLatin1Char('y'))).arg(QString(80, QLatin1Char('z')));
+        int iterations = 0;
+        QElapsedTimer timer;
+        timer.start();
+        QBENCHMARK {
+            worker.navigateTo(1, QString("http://tracking.example.com/article?id=%1%2").arg(iterations).arg(tracking), "Article", "");
+            worker.flush();
+            ++iterations;
+        }
+        record(timer.nsecsElapsed(), iterations, urlIndexSize());
+    }
+}
+
+void bench_dbworker::getHistory_data()
+{
+    addDatasets();
+}
+
+void bench_dbworker::getHistory()
+{
+    {
+        DBWorker worker;
+        QVERIFY(createDatabase(&worker));
+
+        int iterations = 0;
+        QElapsedTimer timer;
+        timer.start();
+        QBENCHMARK {
+            worker.getHistory(QString());
+            ++iterations;
+        }
+        record(timer.nsecsElapsed(), iterations);
+    }
+}
+
+void bench_dbworker::getHistoryFiltered_data()
+{
+    addDatasets();
+}
+
+void bench_dbworker::getHistoryFiltered()
+{
+    {
+        DBWorker worker;
+        QVERIFY(createDatabase(&worker));
+
+        // Typing a url, one query per keystroke
+        int iterations = 0;
+        QElapsedTimer timer;
+        timer.start();
+        QBENCHMARK {
+            worker.getHistory("s");
+            worker.getHistory("si");
+            worker.getHistory("site");
+            worker.getHistory("site42");
+            worker.getHistory("site42 wiki");
+            ++iterations;
+        }
+        record(timer.nsecsElapsed(), iterations);
+    }
+}
+
+void bench_dbworker::getAllTabs_data()
+{
+    addDatasets();
+}
+
+void bench_dbworker::getAllTabs()
+{
+    {
+        DBWorker worker;
+        QVERIFY(createDatabase(&worker));
+
+        int iterations = 0;
+        QElapsedTimer timer;
+        timer.start();
+        QBENCHMARK {
+            worker.getAllTabs();
+            ++iterations;
+        }
+        record(timer.nsecsElapsed(), iterations);
+    }
+}
+
+void bench_dbworker::getTabHistory_data()
+{
+    addDatasets();
+}
+
+void bench_dbworker::getTabHistory()
+{
+    QFETCH(int, tabs);
+
+    {
+        DBWorker worker;
+        QVERIFY(createDatabase(&worker));
+
+        int iterations = 0;
+        QElapsedTimer timer;
+        timer.start();
+        QBENCHMARK {
+            worker.getTabHistory(1 + iterations % tabs);
+            ++iterations;
+        }
+        record(timer.nsecsElapsed(), iterations);
+    }
+}
+
+void bench_dbworker::removeTab_data()
+{
+    addDatasets();
+}
+
+void bench_dbworker::removeTab()
+{
+    QFETCH(int, tabs);
+
+    {
+        DBWorker worker;
+        QVERIFY(createDatabase(&worker));
+
+        // Tabs run out, so every tab is removed once
+        QElapsedTimer timer;
+        timer.start();
+        QBENCHMARK_ONCE {
+            for (int tabId = 1; tabId <= tabs; ++tabId) {
+                worker.removeTab(tabId);
+                worker.flush();
+            }
+        }
+        record(timer.nsecsElapsed(), tabs);
+    }
+}
+
+void bench_dbworker::clearHistory_data()
+{
+    addDatasets();
+}
+
+void bench_dbworker::clearHistory()
+{
+    {
+        DBWorker worker;
+        QVERIFY(createDatabase(&worker));
+
+        QElapsedTimer timer;
+        timer.start();
+        QBENCHMARK_ONCE {
+            worker.clearHistory();
+            worker.flush();
+        }
+        record(timer.nsecsElapsed(), 1);
+    }
+}
+
+void bench_dbworker::startup_data()
+{
+    addDatasets();
+}
+
+// DBWorker::init() on an existing database
+void bench_dbworker::startup()
+{
+    QVERIFY(generateDatabase());
+
+    int iterations = 0;
+    QElapsedTimer timer;
+    timer.start();
+    QBENCHMARK {
+        {
+            DBWorker worker;
+            worker.init();
+        }
+        QSqlDatabase::removeDatabase(QSqlDatabase::defaultConnection);
+        ++iterations;
+    }
+    record(timer.nsecsElapsed(), iterations);
+}
+
+QTEST_GUILESS_MAIN(bench_dbworker)
+#include "bench_dbworker.moc"
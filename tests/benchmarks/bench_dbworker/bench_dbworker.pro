@@ -0,0 +1,15 @@
+TARGET = bench_dbworker
+
+QT += sql testlib
+QT -= gui
+
+CONFIG += c++11
+
+include(../../../defaults.pri)
+include(../../../common/browserapp.pri)
+include(../../../apps/storage/storage.pri)
+
+SOURCES += bench_dbworker.cpp
+
+target.path = /opt/tests/sailfish-browser/benchmarks
+INSTALLS += target